@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "atlasBusScanner.h"
 #include "atlasEC.h"
 #include "atlasPH.h"
 #include "atlasRTD.h"
@@ -0,0 +1,93 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include "atlasSensor.h"
+
+class AtlasRTD;
+
+// AtlasBusScanner discovers EZO devices on an I2C port and instantiates the matching
+// AtlasSensor subclass for each one, so installs don't need per-site address tables.
+//
+// Scanning runs on the scanner's own DispatchTask. Probing and the EZO "i" round trip
+// are blocking I2C operations and must never stall the runloop the sensors take their
+// readings on. Every responder is sent "i" before any of them is read back so a full
+// scan costs a single EZO processing delay rather than one per device.
+//
+// Observers receive a SensorMessage with tag attached or detached. The message retains
+// its sensor for the duration of the callback; retain the sensor to keep it longer.
+class AtlasBusScanner :
+    public Observed
+{
+
+public:
+
+    enum class MessageTag { attached = 1, detached = 2 };
+
+    struct SensorMessage : public Observed::Message {
+        SensorMessage(MessageTag tag, AtlasSensor *sensor, uint8_t address);
+
+        AtlasSensor *           sensor;
+        uint8_t                 address;
+
+    protected:
+
+       ~SensorMessage() override;
+    };
+
+    AtlasBusScanner();
+
+    // Returns the sensor at address or nullptr. The sensor is not retained.
+    AtlasSensor *               getSensor(uint8_t address);
+    // sensorTask is the DispatchTask discovered sensors run on (nullptr for the shared task).
+    // A rescanIntervalMs of 0 disables background rescans; call scan() to rescan manually.
+    err_t                       init(DispatchTask *sensorTask = nullptr, uint32_t rescanIntervalMs = 30 * 1000, i2c_port_num_t portNumber = I2C_NUM_0);
+    // scan() is asynchronous, it schedules a scan on the scanner's task and returns immediately.
+    void                        scan();
+
+    static AtlasBusScanner &    shared();
+
+    static const uint8_t        firstAddress = 0x08;    // 0x00 - 0x07 are reserved
+    static const uint8_t        lastAddress = 0x77;     // 0x78 - 0x7f are reserved
+    // a bound sensor is detached after this many consecutive failed probes
+    static const uint8_t        missedProbesBeforeDetach = 2;
+
+protected:
+
+   ~AtlasBusScanner() override;
+
+private:
+
+    class ScanTask;
+
+    enum class SensorType { unknown, ec, ph, rtd };
+
+    struct Entry {
+        AtlasSensor *           sensor = nullptr;
+        SensorType              type = SensorType::unknown;
+        uint8_t                 missedProbes = 0;
+    };
+
+    void                        attach(uint8_t address, SensorType type);
+    void                        detach(uint8_t address);
+    AtlasRTD *                  findTemperatureProvider();
+    void                        handleEvent(DispatchEventSource *source);
+    AtlasSensor *               makeSensor(SensorType type);
+    err_t                       readInfo(I2C::DeviceHandle device, SensorType &type);
+
+    static void                 eventHandler(void *context, DispatchEventSource *source);
+    static SensorType           sensorTypeFromString(const char *sensorType);
+
+    Entry                       entries[lastAddress + 1];
+    I2C *                       i2c = nullptr;
+    Lock                        lock;
+    i2c_port_num_t              portNumber = I2C_NUM_0;
+    uint32_t                    rescanIntervalMs = 0;
+    ScanTask *                  scanTask = nullptr;
+    DispatchTask *              sensorTask = nullptr;
+    DispatchTimerSource *       timer = nullptr;
+
+};
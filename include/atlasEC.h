@@ -29,6 +29,7 @@ public:
     using ParametersResponseCallback = CommandCallback;     // response will downcast to ParametersResponse &
 
     AtlasEC();
+    AtlasEC(TemperatureProvider *temperatureProvider);
 
     // ec value is returned in µS/cm, but most conversion functions require mS/cm
     virtual double              convertReadingResponseToDouble(char *response);
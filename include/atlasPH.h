@@ -24,6 +24,7 @@ public:
     using SlopeResponseCallback = CommandCallback;      // response will downcast to SlopeResponse &
 
     AtlasPH();
+    AtlasPH(TemperatureProvider *temperatureProvider);
 
     virtual uint32_t            getReadingResponseWaitMs() { return 900; }
 #if ENABLE_ATLAS_SIMULATOR
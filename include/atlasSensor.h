@@ -9,6 +9,7 @@
 #include "i2c.h"
 #include "named.h"
 #include "observed.h"
+#include "pooled.h"
 
 // 2023.06.05 talked to Dmitry @ Atlas Scientific
 
@@ -37,9 +38,12 @@ public:
         double                  when = DBL_MIN;
     };
 
-    struct ReadingMessage : public Observed::Message {
+    // ReadingMessages are recycled, a sensor reporting steadily doesn't touch the heap
+    struct ReadingMessage : public Observed::Message, public Pooled<ReadingMessage, 8> {
         ReadingMessage(double value, UnixTime when);
 
+        bool                    getValue(double &value) const override { value = this->value; return true; }
+
         double                  value;
     };
 
@@ -151,6 +155,8 @@ public:
     virtual err_t               sendSetProtocolLock(bool isEnabled, bool synchronous = true, void *context = nullptr, CommandCallback callback = nullptr);
     virtual err_t               sendSleep(bool synchronous = true, void *context = nullptr, CommandCallback callback = nullptr);
     void                        setForcedValue(bool isEnabled, double forcedValue = 0);
+    // sensors talk to I2C_NUM_0 unless told otherwise. Call prior to init().
+    void                        setI2CPort(i2c_port_num_t portNumber);
     virtual void                stop(); // stops recording and clears the command queue
 
 #if ENABLE_ATLAS_SIMULATOR
@@ -233,23 +239,40 @@ protected:
 
 private:
 
+    // Bus I/O for the pending command runs as a state machine driven by timer events:
+    // sending -> writing -> (responseWaitMs) -> waitingForResponse -> reading -> idle.
+    // send() sets sending under the lock as it takes the command, and idle if it finishes
+    // the command without the bus. Events seen while sending are strays and wait.
+    enum class IOState : uint8_t { idle, sending, writing, waitingForResponse, reading };
+
     void                        handleEvent(DispatchEventSource *source);
-    err_t                       readResponse(Command *command, char *responseBuffer, size_t responseBufferSize);
+    err_t                       parseResponseBuffer(const uint8_t *buffer, size_t bufferSize, char *responseBuffer, size_t responseBufferSize);
+    // processIO() advances the I/O state machine. It returns EINPROGRESS while the
+    // command is still waiting on the bus or the EZO device.
+    err_t                       processIO(Command *command, char *responseBuffer, size_t responseBufferSize);
+#if ENABLE_ATLAS_SIMULATOR
+    err_t                       simulateResponse(Command *command, char *responseBuffer, size_t responseBufferSize);
+#endif
+    err_t                       submitTransaction(I2C::Transaction::Operation operation, uint8_t *buffer, size_t length);
 
     static void                 eventHandler(void *context, DispatchEventSource *source);
 
     Command *                   commands = nullptr;
     double                      forcedValue = 0;
+    I2C *                       i2c;
     I2C::DeviceHandle           i2cDevice = nullptr;
+    uint8_t                     ioBuffer[1 + 40 + 1];   // response byte + largest string + terminator
+    IOState                     ioState = IOState::idle;
     bool                        isForcedValue = false;
     bool                        isGetReadingActive = false;
+    bool                        isSendDeferred = false; // handleEvent() resends once the breaker's retry timer fires
     bool                        isStopped = false;
     Reading                     lastReading;
     Command *                   pendingCommand = nullptr;
     RecursiveLock               recursiveLock;
     DispatchTimerSource *       timer = nullptr;
+    I2C::Transaction            transaction;
 
-    static I2C &                i2c;
 };
 
 template<typename T> err_t AtlasSensor::makeAndSendCommand(bool synchronous, const char *format, void *completionContext, CommandCallback completionCallback, const char *responsePrefix, uint32_t responseWaitMs, Priority priority, CompletionBehavior completionBehavior, ...) {
@@ -15,6 +15,7 @@ public:
     AtlasTemperatureCompensatedSensor(TemperatureProvider *temperatureProvider = nullptr);
 
     virtual double              getCurrentTemperature();
+    TemperatureProvider *       getTemperatureProvider();
     bool                        isForcedTemperatureEnabled(double &forcedTemperature) { forcedTemperature = forcedDegreesC; return isForcedTemperature; }
     virtual bool                isSetTemperatureCompensationAndTakeReadingSupported();
     virtual err_t               sendGetTemperatureCompensation(bool synchronous = true, void *context = nullptr, DoubleResponseCallback callback = nullptr);
@@ -29,6 +30,9 @@ public:
     //  - if shouldSendSetTemperatureCompensation is also true,
     //      sendSetTemperatureCompensation(synchronous) is issued immediately.
     err_t                       setForcedTemperature(bool isEnabled, double forcedDegreesC = defaultTemperatureC, bool shouldSendSetTemperatureCompensation = true, bool synchronous = true);
+    // The provider is only called with the sensor lock held, so once setTemperatureProvider()
+    // returns the old provider will not be called again and can be released.
+    void                        setTemperatureProvider(TemperatureProvider *temperatureProvider);
 
     static constexpr double     defaultTemperatureC = 25.0;
     
@@ -43,6 +47,9 @@ protected:
 
 private:
 
+    // returns DBL_MIN if there is no temperature provider
+    double                      getProviderTemperature();
+
     double                      forcedDegreesC = defaultTemperatureC;
     bool                        isForcedTemperature = false;
 #if ENABLE_ATLAS_SIMULATOR
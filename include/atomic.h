@@ -5,23 +5,107 @@
 
 #pragma once
 
-#include <stdatomic.h>
-#include <stdbool.h>
 #include <stdint.h>
 
-#ifdef __cplusplus
-extern "C" {
-#endif
+#include <type_traits>
 
-typedef _Atomic(uint32_t) AtomicUInt32;
-
-// these operations all use memory_order_relaxed, suitable only for simple counters.
-bool atomicUInt32CompareExchange(AtomicUInt32 *object, uint32_t *expected, uint32_t desired);
-void atomicUInt32Decrement(AtomicUInt32 *object);
-void atomicUInt32Increment(AtomicUInt32 *object);
-uint32_t atomicUInt32Load(const AtomicUInt32 *object);
-void atomicUInt32Store(AtomicUInt32 *object, uint32_t value);
+// A thin, header-only layer over the compiler's __atomic builtins. Every operation takes
+// an explicit MemoryOrder and compiles to a single instruction (or the shortest sequence
+// the target has), with no function call in between.
+//
+// Choosing an order:
+//  - relaxed: the value alone matters, e.g. a statistic or taking another reference.
+//  - release: publishes everything written before it, e.g. counting an event after
+//    filling in its data, or dropping a reference.
+//  - acquire: sees everything published by the release it reads from, e.g. taking an
+//    event, or deleting an object once its last reference is gone.
+//  - acqRel: both, for a read-modify-write that takes and publishes at once.
+//  - seqCst: a single total order across all seqCst operations. Needed only when two
+//    tasks each write one location and read another (Dekker style).
+//
+// On the dual-core ESP32 relaxed is only enough when nothing else hangs off the value.
+enum class MemoryOrder : int {
+    relaxed = __ATOMIC_RELAXED,
+    acquire = __ATOMIC_ACQUIRE,
+    release = __ATOMIC_RELEASE,
+    acqRel  = __ATOMIC_ACQ_REL,
+    seqCst  = __ATOMIC_SEQ_CST,
+};
 
-#ifdef __cplusplus
+inline void atomicThreadFence(MemoryOrder order) {
+    __atomic_thread_fence(int(order));
 }
-#endif
+
+// AtomicRef applies atomic operations to an existing object, like std::atomic_ref. It is
+// for fields that are mostly touched under a lock or by one task, but are read or updated
+// lock-free in a few places. Every concurrent access to the object must go through
+// AtomicRef (or the builtins) for the duration.
+template<typename T>
+requires std::is_trivially_copyable_v<T>
+class AtomicRef {
+
+public:
+
+    explicit AtomicRef(T &object) : object(&object) { }
+
+    // compareExchange() stores desired if the object holds expected and returns true,
+    // otherwise it loads the current value into expected and returns false. The weak
+    // form may fail spuriously and belongs in a loop, where it is cheaper.
+    bool                        compareExchange(T &expected, T desired, MemoryOrder success, MemoryOrder failure = MemoryOrder::relaxed) const {
+        return __atomic_compare_exchange_n(object, &expected, desired, false, int(success), int(failure));
+    }
+    bool                        compareExchangeWeak(T &expected, T desired, MemoryOrder success, MemoryOrder failure = MemoryOrder::relaxed) const {
+        return __atomic_compare_exchange_n(object, &expected, desired, true, int(success), int(failure));
+    }
+    T                           exchange(T value, MemoryOrder order) const { return __atomic_exchange_n(object, value, int(order)); }
+    T                           load(MemoryOrder order) const { return __atomic_load_n(object, int(order)); }
+    void                        store(T value, MemoryOrder order) const { __atomic_store_n(object, value, int(order)); }
+
+    // the fetch operations return the value before the operation
+    T                           fetchAdd(T value, MemoryOrder order) const requires std::is_integral_v<T> { return __atomic_fetch_add(object, value, int(order)); }
+    T                           fetchAnd(T value, MemoryOrder order) const requires std::is_integral_v<T> { return __atomic_fetch_and(object, value, int(order)); }
+    T                           fetchOr(T value, MemoryOrder order) const requires std::is_integral_v<T> { return __atomic_fetch_or(object, value, int(order)); }
+    T                           fetchSub(T value, MemoryOrder order) const requires std::is_integral_v<T> { return __atomic_fetch_sub(object, value, int(order)); }
+
+private:
+
+    T *                         object;
+
+};
+
+// Atomic holds a value that is only ever accessed atomically, like std::atomic but with
+// no implicit seq_cst operators: every access names its order.
+template<typename T>
+requires std::is_trivially_copyable_v<T>
+class Atomic {
+
+public:
+
+    Atomic() = default;
+    constexpr Atomic(T value) : value(value) { }
+    Atomic(const Atomic &) = delete;
+
+    Atomic &                    operator=(const Atomic &) = delete;
+
+    bool                        compareExchange(T &expected, T desired, MemoryOrder success, MemoryOrder failure = MemoryOrder::relaxed) {
+        return ref().compareExchange(expected, desired, success, failure);
+    }
+    bool                        compareExchangeWeak(T &expected, T desired, MemoryOrder success, MemoryOrder failure = MemoryOrder::relaxed) {
+        return ref().compareExchangeWeak(expected, desired, success, failure);
+    }
+    T                           exchange(T newValue, MemoryOrder order) { return ref().exchange(newValue, order); }
+    T                           load(MemoryOrder order) const { return __atomic_load_n(&value, int(order)); }
+    void                        store(T newValue, MemoryOrder order) { ref().store(newValue, order); }
+
+    T                           fetchAdd(T delta, MemoryOrder order) requires std::is_integral_v<T> { return ref().fetchAdd(delta, order); }
+    T                           fetchAnd(T mask, MemoryOrder order) requires std::is_integral_v<T> { return ref().fetchAnd(mask, order); }
+    T                           fetchOr(T mask, MemoryOrder order) requires std::is_integral_v<T> { return ref().fetchOr(mask, order); }
+    T                           fetchSub(T delta, MemoryOrder order) requires std::is_integral_v<T> { return ref().fetchSub(delta, order); }
+
+private:
+
+    AtomicRef<T>                ref() { return AtomicRef<T>(value); }
+
+    T                           value = T();
+
+};
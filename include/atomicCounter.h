@@ -54,12 +54,21 @@
 // rather it is used purely to avoid race conditions so we don't
 // lose track of any events.
 
+//
+// 2025 update: AtomicCounter is header-only on top of Atomic, so each operation inlines to a
+// single atomic instruction. Increments release and decrement() acquires, so whoever takes
+// a count sees everything written before it was added: an event handler sees the data its
+// event was dispatched with, even when the source was already queued and the increment is
+// the only release on the way. operator--() and fetchAndSet() are acqRel, they both take a
+// count and publish. ReferenceCounted uses fetchAdd() and fetchSub() directly with the
+// orders a reference count needs.
+
 class AtomicCounter {
 
 public:
 
-    AtomicCounter(uint32_t initialValue = 0);
-    AtomicCounter(const AtomicCounter &other);
+    AtomicCounter(uint32_t initialValue = 0) : count(initialValue) { }
+    AtomicCounter(const AtomicCounter &other) : count(other.count.load(MemoryOrder::relaxed)) { }
 
     // decrement() tries to atomically decrement the counter
     // by one. It returns true if the counter was greater
@@ -67,14 +76,31 @@ public:
     // if the counter was or became zero prior to the decrement
     // operation completing.
     bool                        decrement();
-    uint32_t                    fetchAndSet(uint32_t newValue);
-    AtomicCounter &             operator++();
-    AtomicCounter &             operator--();
-    AtomicCounter &             operator=(uint32_t newValue);
-    operator                    uint32_t() const;
+    // fetchAndSet() stores newValue and returns the value it replaced, in one exchange
+    uint32_t                    fetchAndSet(uint32_t newValue) { return count.exchange(newValue, MemoryOrder::acqRel); }
+    // fetchAdd() and fetchSub() return the value before the operation
+    uint32_t                    fetchAdd(uint32_t delta, MemoryOrder order) { return count.fetchAdd(delta, order); }
+    uint32_t                    fetchSub(uint32_t delta, MemoryOrder order) { return count.fetchSub(delta, order); }
+    // release: the increment publishes the event's data to the acquire that takes the count
+    AtomicCounter &             operator++() { count.fetchAdd(1, MemoryOrder::release); return *this; }
+    AtomicCounter &             operator--() { count.fetchSub(1, MemoryOrder::acqRel); return *this; }
+    AtomicCounter &             operator=(uint32_t newValue) { count.store(newValue, MemoryOrder::release); return *this; }
+    operator                    uint32_t() const { return count.load(MemoryOrder::acquire); }
 
 private:
 
-    AtomicUInt32                count;
+    Atomic<uint32_t>            count;
 
 };
+
+inline bool AtomicCounter::decrement() {
+    uint32_t value = count.load(MemoryOrder::relaxed);
+
+    // a plain fetchSub() could take the count below zero, so this stays a CAS loop. A
+    // failed compareExchangeWeak() refreshes value.
+    while (value) {
+        if (count.compareExchangeWeak(value, value - 1, MemoryOrder::acquire)) return true;
+    }
+
+    return false;
+}
@@ -6,6 +6,8 @@
 #pragma once
 
 #include "condition.h"
+#include "dispatchPool.h"
 #include "dispatchTask.h"
 #include "dispatchTimerSource.h"
+#include "dispatchTimerWheel.h"
 #include "recursiveLock.h"
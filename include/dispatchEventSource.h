@@ -8,6 +8,7 @@
 #include "atomicCounter.h"
 #include "list.h"
 #include "referenceCounted.h"
+#include "spscRing.h"
 
 class DispatchTask;
 
@@ -22,8 +23,15 @@ class DispatchTask;
 // Note that handling an event in handleEvent(DispatchEventSource *source) does block the DispatchTask's runloop, so if the handler
 // performs a long running operation it is best to use handleEvent(DispatchEventSource *source) to enqueue an operation onto a
 // dedicated handler task.
+//
+// An event source can optionally carry a payload per event. After enablePayloads(), each
+// eventCallbackFromISR() or dispatchEventWithPayload() also records the time of the event
+// and a 32 bit value in a lock-free ring, and the handler drains the ring in batches with
+// drainPayloads(). The ring has a single producer: only one ISR (or task) may record
+// payloads for a given source. Several payloads may be drained by one handler call, so
+// later calls for the same batch can find the ring empty.
 class DispatchEventSource :
-    public ListElement<DispatchEventSource>,
+    public DoublyLinkedListElement<DispatchEventSource>,
     public ReferenceCounted<DispatchEventSource>
 {
 
@@ -33,6 +41,16 @@ public:
 
     using EventHandler = void (*)(void *context, DispatchEventSource *source);
 
+    // Ready sources are handled strictly by priority lane, round robin within a lane.
+    enum class Priority : uint8_t { critical, normal, background };
+
+    static const uint8_t        prioritiesCount = 3;
+
+    struct Payload {
+        uint32_t                data;
+        int64_t                 timestamp;          // esp_timer_get_time() when the event was dispatched
+    };
+
     // A DispatchEventSource can only be on one task at a time. If a DispatchEventSource is already
     // on a DispatchTask when addToDispatchTask() is called, the DispatchEventSource will be removed
     // from the old DispatchTask prior to being added to the new one.
@@ -41,9 +59,29 @@ public:
     virtual void                addToDispatchTask(DispatchTask *task = nullptr);
     virtual void                clearEvents();
     virtual void                dispatchEvent(bool fromISR = false);
+    // dispatchEventWithPayload() records data with the current time and dispatches an event.
+    // If the ring is full the payload is dropped (and counted) but the event is still dispatched.
+    void                        dispatchEventWithPayload(uint32_t data, bool fromISR = false);
+    // drainPayloads() moves up to maxCount payloads, oldest first, into payloads and returns
+    // the number moved. Call it only from the event handler.
+    size_t                      drainPayloads(Payload *payloads, size_t maxCount);
+    // enablePayloads() allocates the payload ring. Call it before the source's ISR is installed.
+    err_t                       enablePayloads(size_t capacity);
+    uint32_t                    getDeadline() const { return deadlineMicroseconds; }
+    // getName() identifies the source in diagnostics such as the dispatch profiler
+    virtual const char *        getName() const { return "DispatchEventSource"; }
+    // the number of payloads dropped because the ring was full
+    uint32_t                    getDroppedPayloads() const { return payloads ? payloads->getDropped() : 0; }
+    Priority                    getPriority() const { return priority; }
     // init() calls addToDispatchTask(task) as a convenience.
     err_t                       init(EventHandler eventHandler, void *context, DispatchTask *task = nullptr);
     virtual void                removeFromDispatchTask();
+    // A source with a deadline expects its handler to start within deadlineMicroseconds of
+    // dispatchEvent(). Within a lane such sources run earliest deadline first, ahead of
+    // sources without one. 0 (the default) means no deadline.
+    void                        setDeadline(uint32_t deadlineMicroseconds) { this->deadlineMicroseconds = deadlineMicroseconds; }
+    // Takes effect the next time the source is queued.
+    void                        setPriority(Priority priority) { this->priority = priority; }
 
 protected:
 
@@ -55,9 +93,40 @@ protected:
 
 private:
 
+    struct ReadyPolicy;
+
     void *                      context = nullptr;
     DispatchTask *              dispatchTask = nullptr;
     AtomicCounter               eventCount;
     EventHandler                eventHandler = nullptr;
+#if ENABLE_DISPATCH_PROFILER
+    struct Profile {
+        uint32_t                events = 0;
+        uint32_t                maxLatencyMicroseconds = 0;
+        uint32_t                maxRunMicroseconds = 0;
+        uint32_t                overBudget = 0;
+        uint64_t                totalLatencyMicroseconds = 0;
+        uint64_t                totalRunMicroseconds = 0;
+    };
+
+    Profile                     profile;
+#endif
+    SPSCRing<Payload> *         payloads = nullptr;
+    uint32_t                    deadlineMicroseconds = 0;
+    Priority                    priority = Priority::normal;
+    // isQueued is set while the source is on (or being handled from) its task's ready
+    // queue, readyNext links it there. On a lane's deadline heap readyChild and readyNext
+    // are the pairing heap's child and sibling links. These are owned by DispatchTask.
+    bool                        isQueued = false;
+    int64_t                     readyAt = 0;
+    DispatchEventSource *       readyChild = nullptr;
+    int64_t                     readyDeadline = 0;
+    DispatchEventSource *       readyNext = nullptr;
+    uint32_t                    readySequence = 0;      // breaks deadline ties in arrival order
+
+};
 
+// links sources on their task's ready queue through readyNext, leaving next to the source list
+struct DispatchEventSource::ReadyPolicy : public IntrusivePolicy<DispatchEventSource> {
+    static DispatchEventSource *&next(DispatchEventSource *node) noexcept { return node->readyNext; }
 };
@@ -0,0 +1,52 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include "dispatchTask.h"
+
+// A DispatchPool runs one DispatchTask pinned to each core. Event sources are placed on a
+// worker with getTask(), either on a requested core or round robin.
+//
+// A worker that is idle while a sibling is tied up in a long handler steals ready sources
+// from that sibling's queue. A stolen source is handled exactly as if its own worker had
+// run it: it stays on its worker, and since a source is only ever on one ready queue, and
+// stays off it until its handler returns, its handler never runs on two cores at once.
+//
+// Handlers on pool workers may run in parallel with handlers of other sources, so objects
+// shared between sources need their own locking. Sources that rely on being serialized
+// with each other belong on the same plain DispatchTask instead.
+class DispatchPool {
+
+public:
+
+    DispatchPool() = default;
+    DispatchPool(DispatchPool const &) = delete;
+   ~DispatchPool();
+
+    void                        operator=(DispatchPool const &) = delete;
+
+    uint32_t                    getSteals() const { return steals; }
+    // getTask() returns the worker pinned to coreID or, given tskNO_AFFINITY, the next worker
+    // round robin. Before init() it returns DispatchTask::shared().
+    DispatchTask *              getTask(BaseType_t coreID = tskNO_AFFINITY);
+    size_t                      getTasksCount() const { return tasksCount; }
+    err_t                       init(const char *taskNamePrefix = "DispatchPool");
+
+    static DispatchPool &       shared();
+
+private:
+
+    friend class                DispatchTask;
+
+    void                        notifyIdle(DispatchTask *busyTask, bool fromISR);
+    DispatchEventSource *       steal(DispatchTask *thief, DispatchTask *&victim);
+
+    AtomicCounter               nextTask;
+    AtomicCounter               steals;
+    DispatchTask *              tasks[portNUM_PROCESSORS] = {};
+    size_t                      tasksCount = 0;
+
+};
@@ -5,22 +5,114 @@
 
 #pragma once
 
+#include <errno.h>
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
 #include "dispatchEventSource.h"
+#include "dispatchTimerWheel.h"
+#include "mpscQueue.h"
 #include "recursiveLock.h"
 #include "retainedList.h"
 #include "task.h"
 
+#if ENABLE_DISPATCH_PROFILER
+#include <cJSON.h>
+
+#include "dispatchTimerSource.h"
+
+// handlers running longer than this are counted as over budget
+#ifndef DISPATCH_PROFILER_BUDGET_MICROSECONDS
+#define DISPATCH_PROFILER_BUDGET_MICROSECONDS   (10 * 1000)
+#endif
+// handlers running longer than this are logged as stalls, well ahead of the task watchdog firing
+#define DISPATCH_PROFILER_STALL_MICROSECONDS    (TASK_WATCHDOG_TIMEOUT_SECONDS * 1000000ull / 4)
+#endif
+
+class DispatchPool;
+
 // A DispatchTask manages objects that wait for events such as timers.
 // Typical usage is to enqueue objects onto the shared instance.
+//
+// dispatchEvent() pushes its source onto a lock-free ready queue (safe from an ISR)
+// so run() finds the next source in O(1) instead of scanning every registered source.
+// A source is on the ready queue at most once. It handles one event per turn and then
+// goes to the back of the queue if it has more, so a busy source can't starve the rest.
+//
+// There is a ready queue per DispatchEventSource::Priority lane. A lane is only served
+// when every higher priority lane is empty. Within a lane, sources with a deadline are
+// served earliest deadline first, then the rest round robin.
+//
+// async() and asyncAfter() queue a callable onto the runloop without needing a
+// DispatchEventSource subclass. Queued callables are drained in batches by one internal
+// source, so a burst of them costs a single trip through the ready queue.
+//
+// A DispatchTask can also be one of the workers of a DispatchPool. See dispatchPool.h.
 class DispatchTask : public Task {
 
     friend class                DispatchEventSource;
+    friend class                DispatchPool;
 
-    using SourceList = IntrusiveRetainedList<DispatchEventSource>;
+    using SourceList = IntrusiveDoublyLinkedRetainedList<DispatchEventSource>;
 
 public:
  
-    DispatchTask(bool shouldAllocateTaskInSPIRAM = true) : Task(TASK_DEFAULT_STACK_SIZE, shouldAllocateTaskInSPIRAM) { }
+    DispatchTask(bool shouldAllocateTaskInSPIRAM = true, BaseType_t coreID = tskNO_AFFINITY) :
+        Task(TASK_DEFAULT_STACK_SIZE, shouldAllocateTaskInSPIRAM),
+        coreID(coreID)
+    { }
+
+   ~DispatchTask() override;
+
+    struct LaneStatistics {
+        uint32_t                events = 0;
+        uint32_t                maxQueueingDelayMicroseconds = 0;
+        uint32_t                missedDeadlines = 0;
+        uint64_t                totalQueueingDelayMicroseconds = 0;
+    };
+
+    // async() runs callable on this task's runloop at the next opportunity. Callables run in
+    // the order they were queued. Captures of up to workItemInlineSize bytes are stored in a
+    // pooled work item, so queueing a small lambda doesn't touch the heap; larger captures
+    // are moved to the heap. Returns ENOMEM if an allocation fails, or EINVAL if the task
+    // hasn't been init()ed, in which case callable is destroyed without being called. Not
+    // callable from an ISR.
+    template<typename Callable>
+    err_t                       async(Callable &&callable) {
+        WorkItem *item = makeWorkItem(std::forward<Callable>(callable));
+
+        if (item == nullptr) return ENOMEM;
+
+        return submit(item);
+    }
+    // asyncAfter() runs callable no sooner than delayMicroseconds from now. slackMicroseconds
+    // works as it does for DispatchTimerSource. Once queued the callable can't be cancelled,
+    // so the task must outlive it.
+    template<typename Callable>
+    err_t                       asyncAfter(uint64_t delayMicroseconds, Callable &&callable, uint32_t slackMicroseconds = 0) {
+        WorkItem *item = makeWorkItem(std::forward<Callable>(callable));
+
+        if (item == nullptr) return ENOMEM;
+
+        return submitAfter(item, delayMicroseconds, slackMicroseconds);
+    }
+    // queueing delay is measured from the source being queued to it being taken off the queue
+    LaneStatistics              getLaneStatistics(DispatchEventSource::Priority priority);
+    BaseType_t                  getTaskCreationCoreID() override { return coreID; }
+
+#if ENABLE_DISPATCH_PROFILER
+    // The profiler records, per event source, the delay from the source being queued to its
+    // handler starting and the handler's run time.
+    //
+    // createProfileJSON() returns {"dispatchProfile":{...}}. The caller must cJSON_Delete() it.
+    cJSON *                     createProfileJSON();
+    void                        logProfileSummary();
+    // startProfileSummary() calls logProfileSummary() every intervalSeconds on this task.
+    err_t                       startProfileSummary(uint32_t intervalSeconds = 60);
+#endif
 
     // the singleton's init() is called in Setup::setupDispatchTask(), which in turn is called very early
     // in the startup sequence.
@@ -29,13 +121,111 @@ public:
     // The singleton is not allocated in SPIRAM
     static DispatchTask &       shared();
 
+    // run() returns to the task runloop (resetting the watchdog) after this many events
+    static const size_t         maxEventsPerRun = 32;
+    // the async work source runs at most this many callables per event before requeueing itself
+    static const size_t         maxWorkItemsPerEvent = 16;
+    // captures up to this size are stored inline, enough for several pointers and scalars
+    static const size_t         workItemInlineSize = 32;
+
 private:
 
+    class WorkSource;
+
+    // WorkItems are recycled through a free list shared by every DispatchTask. callable
+    // points into storage for small captures, otherwise at a heap copy. timer is only used
+    // by asyncAfter().
+    struct WorkItem {
+        using Function = void (*)(void *callable);
+
+        alignas(std::max_align_t)
+        uint8_t                 storage[workItemInlineSize];
+        void *                  callable = nullptr;
+        Function                destroy = nullptr;
+        Function                invoke = nullptr;
+        WorkItem *              next = nullptr;
+        DispatchTask *          task = nullptr;
+        DispatchTimerWheel::Timer timer;
+    };
+
+    // Producers push onto ready, a lock-free MPSC queue. The consumer takes everything queued
+    // at once and files it into deadlines or fifo (arrival order). readyLock guards all but
+    // ready's producer side, so pool siblings can steal.
+    //
+    // deadlines is a pairing heap ordered by deadline, so filing a source is O(1) and
+    // taking the earliest O(log n) amortized; nothing walks the lane with the spinlock held.
+    struct Lane {
+        DispatchEventSource *   deadlines = nullptr;
+        DispatchEventSource *   fifo = nullptr;
+        DispatchEventSource *   fifoTail = nullptr;
+        MPSCQueue<DispatchEventSource, DispatchEventSource::ReadyPolicy> ready;
+        uint32_t                sequence = 0;
+        LaneStatistics          statistics;
+    };
+
     void                        add(DispatchEventSource *eventSource);
+    void                        enqueue(DispatchEventSource *eventSource, bool fromISR);
+    void                        fileReady(Lane &lane);
+    bool                        hasReady();
+    DispatchEventSource *       popReady();
+#if ENABLE_DISPATCH_PROFILER
+    void                        profile(DispatchEventSource *eventSource, int64_t startedAt, int64_t finishedAt);
+#endif
     void                        run() override;
     void                        remove(DispatchEventSource *eventSource);
+    // submit() and submitAfter() take ownership of item, destroying it if they fail
+    err_t                       submit(WorkItem *item);
+    err_t                       submitAfter(WorkItem *item, uint64_t delayMicroseconds, uint32_t slackMicroseconds);
+
+    static WorkItem *           allocateWorkItem();
+    // meldDeadlines() joins two deadline heaps, popDeadline() takes the root off one
+    static DispatchEventSource *meldDeadlines(DispatchEventSource *a, DispatchEventSource *b);
+    static DispatchEventSource *popDeadline(DispatchEventSource *&heap);
+    static void                 drainWork(void *context, DispatchEventSource *source);
+    static void                 freeWorkItem(WorkItem *item);
+    template<typename Callable>
+    static WorkItem *           makeWorkItem(Callable &&callable) {
+        using Type = std::decay_t<Callable>;
+
+        WorkItem *item = allocateWorkItem();
+
+        if (item == nullptr) return nullptr;
+
+        if constexpr (sizeof(Type) <= workItemInlineSize && alignof(Type) <= alignof(std::max_align_t)) {
+            item->callable = new (item->storage) Type(std::forward<Callable>(callable));
+            item->destroy = [](void *object) { static_cast<Type *>(object)->~Type(); };
+        } else {
+            if ((item->callable = new Type(std::forward<Callable>(callable))) == nullptr) {
+                freeWorkItem(item);
+                return nullptr;
+            }
+            item->destroy = [](void *object) { delete static_cast<Type *>(object); };
+        }
+        item->invoke = [](void *object) { (*static_cast<Type *>(object))(); };
+
+        return item;
+    }
+    static void                 workTimerFired(DispatchTimerWheel::Timer *timer);
+
+    static WorkItem *           freeWorkItems;
+    static size_t               freeWorkItemsCount;
+    static portMUX_TYPE         freeWorkItemsLock;
 
+    BaseType_t                  coreID;
+    // isHandling is set while an event handler runs, DispatchPool uses it to find busy workers
+    volatile bool               isHandling = false;
+    DispatchPool *              pool = nullptr;
+#if ENABLE_DISPATCH_PROFILER
+    DispatchTimerSource *       profileTimer = nullptr;
+    uint32_t                    stalls = 0;
+#endif
+    Lane                        lanes[DispatchEventSource::prioritiesCount];
+    portMUX_TYPE                readyLock = portMUX_INITIALIZER_UNLOCKED;
     SourceList                  sources;
     RecursiveLock               sourcesLock;
+    WorkItem *                  workHead = nullptr;
+    portMUX_TYPE                workLock = portMUX_INITIALIZER_UNLOCKED;
+    WorkSource *                workSource = nullptr;
+    WorkItem *                  workTail = nullptr;
 
 };
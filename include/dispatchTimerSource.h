@@ -3,9 +3,8 @@
 // MIT License
 //
 
-#include <esp_timer.h>
-
 #include "dispatchEventSource.h"
+#include "dispatchTimerWheel.h"
 
 class DispatchTimerSource final :
     public DispatchEventSource
@@ -20,7 +19,8 @@ public:
     // 1. Create a DispatchTimerSource member.
     // 2. Call DispatchTimerSource::init() passing an EventHandler and context.
     //      - via DispatchEventSource::init() this adds the event source to the
-    //        shared DispatchTask() and creates a non-ISR based esp_timer.
+    //        shared DispatchTask(). The timer itself runs on the shared
+    //        DispatchTimerWheel rather than an esp_timer of its own.
     //      - When the timer fires DispatchEventSource updates the DispatchTimerSource's
     //        eventCount and calls dispatchTask->notify().
     //      - The DispatchTask, on its runloop, calls the event handler. Since the
@@ -28,10 +28,13 @@ public:
     //        event handler. Just notice the event and perform work on another task.
     // 4. Call startOnce() or startPeriodic() to start the timer.
 
+    const char *                getName() const override { return name ? name : "DispatchTimerSource"; }
     err_t                       init(EventHandler eventHandler, void *context, const char *timerName = "DispatchTimerSource", DispatchTask *task = nullptr);
     void                        removeFromDispatchTask() override;
-    err_t                       startOnce(uint64_t timeoutMicroseconds);
-    err_t                       startPeriodic(uint64_t periodMicroseconds);
+    // slackMicroseconds allows the timer to fire up to that much late so it can
+    // share a wake-up with other timers. See DispatchTimerWheel.
+    err_t                       startOnce(uint64_t timeoutMicroseconds, uint32_t slackMicroseconds = 0);
+    err_t                       startPeriodic(uint64_t periodMicroseconds, uint32_t slackMicroseconds = 0);
     void                        stop();
 
 protected:
@@ -40,6 +43,9 @@ protected:
 
 private:
 
-    esp_timer_handle_t          timer = nullptr;
+    static void                 timerFired(DispatchTimerWheel::Timer *timer);
+
+    const char *                name = nullptr;
+    DispatchTimerWheel::Timer   timer;
 
 };
@@ -0,0 +1,117 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_timer.h>
+
+#include "err_t.h"
+#include "list.h"
+#include "recursiveLock.h"
+
+// DispatchTimerWheel multiplexes any number of software timers onto a single esp_timer.
+//
+// Timers are filed in a hierarchical wheel of levels x slotsPerLevel slots with a 1ms tick.
+// Level 0 holds timers due within 64 ticks, level 1 within 64^2 ticks and so on. As time
+// advances, the slots of the higher levels are cascaded down into the lower ones. start()
+// and stop() are O(1), and the esp_timer is only programmed for the next tick that has
+// work to do, skipping over empty stretches of the wheel.
+//
+// A timer may be given slack. Its expiry is then rounded to a coarser boundary within
+// [deadline, deadline + slack] so timers with nearby deadlines share a single wake-up.
+// Whenever the wheel wakes, it also fires every timer whose [deadline, expiry] window
+// already covers the current tick. A timer with slack therefore rides along with any
+// earlier wake-up in its window rather than waking the CPU again.
+//
+// Timer callbacks are called on the esp_timer task with the wheel lock held. They must
+// not block, but may start or stop timers.
+class DispatchTimerWheel {
+
+public:
+
+    static const uint8_t        levels = 4;
+    static const uint8_t        slotBits = 6;
+    static const uint8_t        slotsPerLevel = 1 << slotBits;
+    static const uint32_t       tickMicroseconds = 1000;
+
+    struct Timer {
+        using Callback = void (*)(Timer *timer);
+
+        Callback                callback = nullptr;
+        void *                  context = nullptr;
+        uint64_t                deadlineTick = 0;       // the requested expiry
+        uint64_t                expiryTick = 0;         // deadlineTick with slack applied
+        bool                    isActive = false;
+        uint8_t                 level = 0;              // levels while waiting in coalescing
+        Timer *                 next = nullptr;
+        uint32_t                periodTicks = 0;        // 0 for a one-shot timer
+        Timer *                 prev = nullptr;
+        uint32_t                slackTicks = 0;
+        uint8_t                 slot = 0;
+    };
+
+    struct Statistics {
+        uint32_t                activeTimers = 0;
+        uint32_t                cascades = 0;           // timers moved down a level
+        uint32_t                coalesced = 0;          // timers fired early in another timer's wake-up
+        uint32_t                fired = 0;
+        uint32_t                occupiedSlots[levels] = {};
+        uint32_t                reprograms = 0;         // esp_timer restarts
+        // an estimate of the wake-ups needed without slack or coalescing, one per distinct deadline fired
+        uint32_t                requestedWakeups = 0;
+        uint32_t                wakeups = 0;            // esp_timer callbacks
+    };
+
+    DispatchTimerWheel(DispatchTimerWheel const &) = delete;
+
+    void                        operator=(DispatchTimerWheel const &) = delete;
+
+    Statistics                  getStatistics();
+    // logStatistics() logs wake-ups per second, actual and requested, since the previous call
+    void                        logStatistics();
+    // start() (re)starts timer. A timer that is already active is first stopped.
+    err_t                       start(Timer *timer, uint64_t timeoutMicroseconds, uint64_t periodMicroseconds = 0, uint32_t slackMicroseconds = 0);
+    // Once stop() returns, timer's callback is not running and won't be called.
+    void                        stop(Timer *timer);
+
+    static DispatchTimerWheel & shared();
+
+private:
+
+    DispatchTimerWheel();
+   ~DispatchTimerWheel();
+
+    void                        advance(uint64_t toTick);
+    void                        cascade(uint64_t tick);
+    void                        coalesce(uint64_t tick);
+    void                        expire(uint64_t tick);
+    void                        fire(Timer *timer, uint64_t tick);
+    uint64_t                    getCurrentTick();
+    void                        insert(Timer *timer);
+    uint64_t                    nextEventTick();
+    void                        program();
+    void                        remove(Timer *timer);
+
+    static void                 timerCallback(void *context);
+
+    size_t                      activeTimers = 0;
+    // the due timers a coalesce() pass has yet to fire, in deadline order
+    IntrusiveDoublyLinkedList<Timer> coalescing;
+    uint64_t                    currentTick = 0;
+    int64_t                     epochMicroseconds;
+    esp_timer_handle_t          hardwareTimer = nullptr;
+    uint64_t                    lastFiredDeadlineTick = UINT64_MAX;
+    RecursiveLock               lock;
+    uint64_t                    occupancy[levels] = {};
+    uint64_t                    programmedTick = UINT64_MAX;
+    Timer *                     slots[levels][slotsPerLevel] = {};
+    Statistics                  statistics;
+    Statistics                  loggedStatistics;
+    int64_t                     statisticsLoggedAt;
+
+};
@@ -7,39 +7,132 @@
 
 #include "common.h"
 
-class I2C {
+// Each I2C bus owns a worker task. Transactions passed to submit() are executed
+// in order on that task so sensor state machines running on a DispatchTask never
+// block in the driver, and separate buses make progress in parallel.
+//
+// read() and write() remain available as blocking calls for callers that are
+// already running on a task of their own.
+//
+// Breaker state, statistics and the registered address bitmap are only touched with
+// busLock held, and busLock is held for the whole of each transaction. The worker and
+// blocking callers such as AtlasBusScanner take turns on the bus.
+class I2C : public Task {
 
 public:
 
+    // Each Device carries a circuit breaker. After breakerFailureThreshold consecutive
+    // bus failures the breaker opens and read()/write() fail fast with ECONNREFUSED
+    // rather than blocking for the full timeout. Once the backoff expires the breaker
+    // goes half open and the next transaction is preceded by a short probe; success
+    // closes the breaker, failure reopens it with double the backoff.
+    enum class BreakerState : uint8_t { closed, open, halfOpen };
+
+    struct Statistics {
+        uint32_t                failures = 0;           // transactions that returned an error
+        uint32_t                fastFails = 0;          // transactions refused while the breaker was open
+        uint32_t                recoveries = 0;         // open/halfOpen -> closed transitions
+        uint32_t                trips = 0;              // closed -> open transitions
+        uint32_t                lastTransactionUs = 0;
+        uint32_t                maxTransactionUs = 0;
+    };
+
     struct Device {
         uint8_t                 address;
         i2c_master_dev_handle_t handle;
+
+        uint32_t                backoffMs = 0;
+        BreakerState            breakerState = BreakerState::closed;
+        uint8_t                 consecutiveFailures = 0;
+        int64_t                 retryAtUs = 0;
+        Statistics              statistics;
     };
 
     typedef Device *DeviceHandle;
 
+    // A Transaction is owned by the submitter and must stay valid, along with its
+    // buffer, until completionSource's event handler runs or cancel() returns. The worker
+    // sets err, clears isPending (release) and then calls completionSource->dispatchEvent(),
+    // so a handler that finds isPending set knows the event wasn't the completion.
+    struct Transaction {
+        enum class Operation : uint8_t { read, write };
+
+        uint8_t *               buffer = nullptr;
+        DispatchEventSource *   completionSource = nullptr;
+        DeviceHandle            device = nullptr;
+        err_t                   err = 0;
+        Atomic<bool>            isPending;
+        size_t                  length = 0;
+        Transaction *           next = nullptr;
+        Operation               operation = Operation::read;
+        uint32_t                timeoutMs = 1000;
+    };
+
+    struct BusStatistics {
+        uint32_t                recoveries = 0;         // calls to recoverBus()
+        uint32_t                recoveryFailures = 0;
+        uint32_t                timeouts = 0;
+    };
+
     I2C(I2C const &) = delete;
-   ~I2C();
+   ~I2C() override;
 
     void                        operator=(I2C const &) = delete;
 
+    BusStatistics               getBusStatistics() const;
+    i2c_port_num_t              getPortNumber() const { return portNumber; }
+    // getRetryDelayMs() returns how long until an open breaker admits a trial transaction.
+    uint32_t                    getRetryDelayMs(DeviceHandle device) const;
     err_t                       init(uint32_t clockSpeed);
+    bool                        isDeviceRegistered(uint8_t address) const;
+    // probe() addresses the slave and returns 0 if it ACKs. No data is transferred
+    // so it is safe to call for addresses that have no registered device.
+    err_t                       probe(uint8_t address, uint32_t timeoutMs = 50);
     err_t                       read(DeviceHandle device, uint8_t *buffer, size_t length, uint32_t timeoutMs = 1000);
+    // recoverBus() resets the controller and clocks SCL until a slave holding SDA low
+    // releases it. It's called automatically after repeated bus timeouts.
+    err_t                       recoverBus();
+    // cancel() takes back a transaction the worker hasn't started, or blocks until the one
+    // it's running is finished, completion dispatched. The transaction is then free to go.
+    void                        cancel(Transaction *transaction);
     // To save space, no attempt is made to prohibit registration of two
     // devices using the same slaveAddress. Don't do that.
     err_t                       registerDevice(uint8_t address, DeviceHandle &device);
+    // submit() queues transaction for the bus worker and returns immediately.
+    err_t                       submit(Transaction *transaction);
     err_t                       unregisterDevice(DeviceHandle device);
     err_t                       write(DeviceHandle device, const char *string, uint32_t timeoutMs = 1000, bool writeTerminatingNull = false);
     err_t                       write(DeviceHandle device, uint8_t *data, size_t length, uint32_t timeoutMs = 1000);
 
     static I2C &                shared(i2c_port_num_t portNumber);
 
+    static const uint8_t        breakerFailureThreshold = 3;
+    static const uint32_t       breakerInitialBackoffMs = 500;
+    static const uint32_t       breakerMaxBackoffMs = 60 * 1000;
+    static const uint32_t       breakerProbeTimeoutMs = 50;
+    // consecutive bus timeouts (across all devices) before recoverBus() is attempted
+    static const uint8_t        busTimeoutsBeforeRecovery = 3;
+
 private:
 
-    I2C(i2c_port_num_t portNumber) : portNumber(portNumber) { };
+    I2C(i2c_port_num_t portNumber) : Task(4 * 1024), portNumber(portNumber) { };
+
+    // admit(), complete() and openBreaker() are called with busLock held
+    err_t                       admit(DeviceHandle device);
+    err_t                       complete(DeviceHandle device, esp_err_t espErr, int64_t startUs, const char *operation, size_t length);
+    void                        openBreaker(DeviceHandle device);
+    void                        run() override;
 
+    uint8_t                     busConsecutiveTimeouts = 0;
+    BusStatistics               busStatistics;
     i2c_master_bus_handle_t     busHandle = nullptr;
+    mutable RecursiveLock       busLock;                // recursive, complete() calls recoverBus()
     uint32_t                    clockSpeed = 0;
     i2c_port_num_t              portNumber;
+    Lock                        queueLock;
+    Transaction *               queueHead = nullptr;
+    Transaction *               queueTail = nullptr;
+    Lock                        runLock;                // held by the worker from dequeue through dispatch
+    uint32_t                    registeredAddresses[128 / 32] = {};
 
 };
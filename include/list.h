@@ -44,9 +44,16 @@ public:
     auto                        insert(Element *e, size_t toIndex = 0) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t>;
 
     void                        clear() noexcept override;
+    // merge() moves every element of source into this list. Both lists must already be
+    // sorted by compare, the result is too. Equal elements from this list come first.
+    template<typename Compare>
+    void                        merge(List &source, Compare compare) noexcept;
     void                        remove(const Element *e) noexcept;
     void                        splice(size_t fromIndex, size_t toIndex) noexcept;
     void                        splice(List &source, Element *e, size_t toIndex) noexcept;
+    // sortedInsert() inserts e into a list sorted by compare, after any equal elements.
+    template<typename Compare>
+    auto                        sortedInsert(Element *e, Compare compare) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t>;
 
     List &                      operator=(List &&) noexcept = default;
 
@@ -71,17 +78,13 @@ auto List<Element, Policy>::append(Element *e) noexcept -> std::conditional_t<Po
     }
     
     NodePtr newNode = Policy::createNode(e);
-    NodePtr *p;
 
     if constexpr (!Policy::isIntrusive) {
         if (!newNode) return ENOMEM;
     }
-    
-    for (p = &this->head; *p; p = &Policy::next(*p)) ;
 
-    *p = newNode;
-    ++this->length;
-    
+    this->link(this->tail ? &Policy::next(this->tail) : &this->head, this->tail, newNode);
+
     if constexpr (!Policy::isIntrusive) return 0;
 }
 
@@ -98,6 +101,7 @@ void List<Element, Policy>::clear() noexcept {
 
     this->head = nullptr;
     this->length = 0;
+    this->tail = nullptr;
 }
 
 template<typename Element, typename Policy>
@@ -111,64 +115,52 @@ auto List<Element, Policy>::insert(Element *e, size_t toIndex) noexcept -> std::
     if (toIndex > this->length) toIndex = this->length;
     
     NodePtr newNode = Policy::createNode(e);
-    NodePtr *p;
+    NodePtr previous, *p;
 
     if constexpr (!Policy::isIntrusive) {
         if (!newNode) return ENOMEM;
     }
     
-    for (p = &this->head; toIndex--; p = &Policy::next(*p)) ;
+    p = this->linkAt(toIndex, previous);
+
+    this->link(p, previous, newNode);
 
-    Policy::next(newNode) = *p;
-    *p = newNode;
-    ++this->length;
-    
     if constexpr (!Policy::isIntrusive) return 0;
 }
 
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && Deletable<Element>
+template<typename Compare>
+void List<Element, Policy>::merge(List &source, Compare compare) noexcept {
+    this->mergeNodes(source, compare);
+}
+
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element> && Deletable<Element>
 void List<Element, Policy>::remove(const Element *e) noexcept {
-    if (!e) return;
-
-    NodePtr *p, q;
-
-    for (p = &this->head; *p; p = &Policy::next(*p)) {
-        if (Policy::extract(*p) == e) {
-            q = *p;
-            *p = Policy::next(*p);
-            if (ownsElements) delete e;
-            Policy::destroy(q);
-            --this->length;
-            return;
-        }
-    }
+    NodePtr previous, *p = this->locate(e, previous);
+
+    if (p == nullptr) return;
+
+    NodePtr q = this->unlink(p, previous);
+
+    if (ownsElements) delete e;
+    Policy::destroy(q);
 }
 
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element> && Deletable<Element>
 void List<Element, Policy>::splice(size_t fromIndex, size_t toIndex) noexcept {
     if (fromIndex >= this->length || toIndex > this->length || fromIndex == toIndex) return;
-    
-    size_t i;
-    NodePtr *from = nullptr, *p, q, *to = nullptr;
 
-    for (i = 0, p = &this->head; *p; ++i, p = &Policy::next(*p)) {
-        if (i == fromIndex) from = p;
-        if (i == toIndex) to = p;
+    NodePtr previous, *p = this->linkAt(fromIndex, previous);
+    NodePtr q = this->unlink(p, previous);
 
-        if (from && to) {
-            // remove
-            q = *from;
-            *from = Policy::next(q);
+    // toIndex names the position before the move, one less once q is out from ahead of it
+    if (fromIndex < toIndex) --toIndex;
 
-            // insert
-            Policy::next(q) = *to;
-            *to = q;
-
-            break;
-        }
-    }
+    p = this->linkAt(toIndex, previous);
+    this->link(p, previous, q);
 }
 
 template<typename Element, typename Policy>
@@ -176,11 +168,37 @@ requires ListNodePolicy<Policy, Element> && Deletable<Element>
 void List<Element, Policy>::splice(List &source, Element *e, size_t toIndex) noexcept {
     if (!e || toIndex > this->length) return;
 
-    // Adjust toIndex if moving to the end of the same list
-    if (&source == this && this->length && toIndex == this->length) --toIndex;
+    NodePtr previous, *p = source.locate(e, previous);
+
+    if (p == nullptr) return;
+
+    // the node moves as is, nothing is destroyed, retained or released
+    NodePtr q = source.unlink(p, previous);
 
-    source.remove(e);
-    insert(e, toIndex);
+    if (toIndex > this->length) toIndex = this->length;
+
+    p = this->linkAt(toIndex, previous);
+    this->link(p, previous, q);
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && Deletable<Element>
+template<typename Compare>
+auto List<Element, Policy>::sortedInsert(Element *e, Compare compare) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t> {
+    if (!e) {
+        if constexpr (!Policy::isIntrusive) return 0;
+        else return;
+    }
+
+    NodePtr newNode = Policy::createNode(e);
+
+    if constexpr (!Policy::isIntrusive) {
+        if (!newNode) return ENOMEM;
+    }
+
+    this->linkSorted(newNode, compare);
+
+    if constexpr (!Policy::isIntrusive) return 0;
 }
 
 // MARK: - Intrusive policy
@@ -224,6 +242,30 @@ IntrusivePolicy<Element>::next(NodePtr node) noexcept {
     return node->next;
 }
 
+// MARK: - Intrusive doubly-linked policy
+
+// For intrusive lists whose elements also provide a 'prev' member, e.g. by deriving from
+// DoublyLinkedListElement. remove() and moveToTail() are then O(1).
+template<typename Element>
+concept IntrusiveDoublyLinkedNode = IntrusiveNode<Element> && requires(Element e) {
+    { e.prev } -> std::convertible_to<Element *>;
+};
+
+template<typename Element>
+requires IntrusiveDoublyLinkedNode<Element>
+struct IntrusiveDoublyLinkedPolicy : IntrusivePolicy<Element> {
+    using NodePtr = typename IntrusivePolicy<Element>::NodePtr;
+
+    static NodePtr &            prev(NodePtr node) noexcept;
+};
+
+template<typename Element>
+requires IntrusiveDoublyLinkedNode<Element>
+typename IntrusiveDoublyLinkedPolicy<Element>::NodePtr &
+IntrusiveDoublyLinkedPolicy<Element>::prev(NodePtr node) noexcept {
+    return node->prev;
+}
+
 // MARK: - Non-intrusive policy
 
 template<typename Element>
@@ -389,6 +431,15 @@ public:
     {}
 };
 
+/**
+ * @brief IntrusiveDoublyLinkedList<Element> — IntrusiveList with O(1) remove()
+ *
+ * As IntrusiveList, but Element must derive from DoublyLinkedListElement<Element>.
+ * remove(e) requires that e is in this list or in no list at all.
+ */
+template<typename Element>
+using IntrusiveDoublyLinkedList = List<Element, IntrusiveDoublyLinkedPolicy<Element>>;
+
 /**
  * @brief NonIntrusiveList<Element> — a non-owning, non-intrusive linked-list
  *
@@ -28,10 +28,22 @@ concept ListNodePolicy = requires(T* element, typename Policy::NodePtr node) {
     { Policy::next(node) } -> std::same_as<typename Policy::NodePtr &>;
 };
 
+// A doubly-linked policy also exposes a node's "prev" pointer. Lists using one
+// unlink an element in O(1) rather than searching for its predecessor.
+template<typename Policy>
+concept DoublyLinkedPolicy = requires(typename Policy::NodePtr node) {
+    { Policy::prev(node) } -> std::same_as<typename Policy::NodePtr &>;
+};
+
 template<typename Element> struct ListElement {
     Element *                   next = nullptr;
 };
 
+template<typename Element> struct DoublyLinkedListElement {
+    Element *                   next = nullptr;
+    Element *                   prev = nullptr;
+};
+
 // MARK: - ListBase
 // Common list functionality that does not impose deletion constraints.
 
@@ -67,16 +79,22 @@ public:
     template<typename Callback>
     void                        iterate(Callback &&callback) const noexcept;
 
+    // Moves e to the end of the list, O(1) for doubly-linked intrusive lists.
+    void                        moveToTail(const Element *e) noexcept;
+
     // Compare: (Element *a, Element *b) -> bool
     // Sorts the list using the provided comparison function.
     // Compare returns true if a is before b.
+    //
+    // sort() is a bottom-up merge sort: O(n log n) comparisons, stable (elements that
+    // compare equal keep their order) and in place, using no memory beyond a few pointers.
     template<typename Compare>
     void                        sort(Compare compare) noexcept;
 
     // Swaps the contents of this list with another.
     void                        swap(ListBase &other) noexcept;
 
-    // Access element by index.
+    // Access element by index. The last element is O(1).
     Element *                   operator[](size_t index) const noexcept;
 
     // disallow copy-assignment since the list owns elements and
@@ -86,8 +104,35 @@ public:
 
 protected:
 
+    // link() inserts node at *link, where previous is the node owning link (nullptr
+    // when link is &head). unlink() removes the node at *link and returns it. Both keep
+    // length, tail and, for doubly-linked policies, the prev pointers up to date.
+    void                        link(NodePtr *link, NodePtr previous, NodePtr node) noexcept;
+    // linkAt() returns the link for index (length is the end of the list) and its owner.
+    NodePtr *                   linkAt(size_t index, NodePtr &previous) noexcept;
+    // locate() returns the link pointing at e's node and its owner, or nullptr if e isn't
+    // in the list. For doubly-linked intrusive lists e must be in this list or none at all.
+    NodePtr *                   locate(const Element *e, NodePtr &previous) noexcept;
+    // relink() rebuilds tail and the prev pointers after the list has been reordered.
+    void                        relink() noexcept;
+    // linkSorted() links node after any elements that don't compare after it, so equal
+    // elements stay in insertion order. Appending in order is O(1).
+    template<typename Compare>
+    void                        linkSorted(NodePtr node, Compare &compare) noexcept;
+    // mergeNodes() moves other's nodes into this list. Both must be sorted by compare.
+    template<typename Compare>
+    void                        mergeNodes(ListBase &other, Compare &compare) noexcept;
+    // mergeRuns() stably merges two sorted, nullptr terminated runs, a's elements first
+    // among equals, and returns the head and last node of the result.
+    template<typename Compare>
+    static NodePtr              mergeRuns(NodePtr a, NodePtr b, Compare &compare, NodePtr &last) noexcept;
+    // splitRun() cuts the run starting at node after count nodes and returns the rest.
+    static NodePtr              splitRun(NodePtr node, size_t count) noexcept;
+    NodePtr                     unlink(NodePtr *link, NodePtr previous) noexcept;
+
     NodePtr                     head = nullptr;
     size_t                      length = 0;
+    NodePtr                     tail = nullptr;
 
 };
 
@@ -95,10 +140,12 @@ template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element>
 ListBase<Element, Policy>::ListBase(ListBase &&other) noexcept
     : head(other.head),
-      length(other.length)
+      length(other.length),
+      tail(other.tail)
 {
     other.head = nullptr;
     other.length = 0;
+    other.tail = nullptr;
 }
 
 template<typename Element, typename Policy>
@@ -135,6 +182,144 @@ void ListBase<Element, Policy>::iterate(Callback &&callback) const noexcept {
     }
 }
 
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+void ListBase<Element, Policy>::link(NodePtr *link, NodePtr previous, NodePtr node) noexcept {
+    Policy::next(node) = *link;
+
+    if constexpr (DoublyLinkedPolicy<Policy>) {
+        Policy::prev(node) = previous;
+        if (*link) Policy::prev(*link) = node;
+    }
+
+    if (*link == nullptr) tail = node;
+
+    *link = node;
+    ++length;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+typename ListBase<Element, Policy>::NodePtr *ListBase<Element, Policy>::linkAt(size_t index, NodePtr &previous) noexcept {
+    NodePtr *p;
+
+    previous = nullptr;
+
+    if (index >= length) {
+        if (tail == nullptr) return &head;
+
+        previous = tail;
+
+        return &Policy::next(tail);
+    }
+
+    for (p = &head; index--; p = &Policy::next(*p)) previous = *p;
+
+    return p;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+template<typename Compare>
+void ListBase<Element, Policy>::linkSorted(NodePtr node, Compare &compare) noexcept {
+    Element *e = Policy::extract(node);
+    NodePtr previous = nullptr, *p;
+
+    if (tail && !compare(e, Policy::extract(tail))) {
+        link(&Policy::next(tail), tail, node);
+        return;
+    }
+
+    for (p = &head; *p && !compare(e, Policy::extract(*p)); p = &Policy::next(*p)) previous = *p;
+
+    link(p, previous, node);
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+typename ListBase<Element, Policy>::NodePtr *ListBase<Element, Policy>::locate(const Element *e, NodePtr &previous) noexcept {
+    NodePtr *p;
+
+    previous = nullptr;
+
+    if (!e) return nullptr;
+
+    if constexpr (DoublyLinkedPolicy<Policy> && Policy::isIntrusive) {
+        NodePtr node = const_cast<Element *>(e);
+
+        if ((previous = Policy::prev(node)) != nullptr) {
+            return Policy::next(previous) == node ? &Policy::next(previous) : nullptr;
+        }
+
+        return head == node ? &head : nullptr;
+    }
+
+    for (p = &head; *p; p = &Policy::next(*p)) {
+        if (Policy::extract(*p) == e) return p;
+
+        previous = *p;
+    }
+
+    return nullptr;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+template<typename Compare>
+void ListBase<Element, Policy>::mergeNodes(ListBase &other, Compare &compare) noexcept {
+    NodePtr last;
+
+    if (this == &other || !other.head) return;
+
+    head = mergeRuns(head, other.head, compare, last);
+    length += other.length;
+
+    other.head = nullptr;
+    other.length = 0;
+    other.tail = nullptr;
+
+    relink();
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+template<typename Compare>
+typename ListBase<Element, Policy>::NodePtr ListBase<Element, Policy>::mergeRuns(NodePtr a, NodePtr b, Compare &compare, NodePtr &last) noexcept {
+    NodePtr result = nullptr, *link = &result;
+
+    last = nullptr;
+
+    while (a && b) {
+        // take b only when it's strictly before a, that's what keeps the merge stable
+        if (compare(Policy::extract(b), Policy::extract(a))) {
+            *link = b;
+            b = Policy::next(b);
+        } else {
+            *link = a;
+            a = Policy::next(a);
+        }
+
+        last = *link;
+        link = &Policy::next(last);
+    }
+
+    for (*link = a ? a : b; *link; link = &Policy::next(*link)) last = *link;
+
+    return result;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+void ListBase<Element, Policy>::moveToTail(const Element *e) noexcept {
+    NodePtr previous, *p = locate(e, previous);
+
+    if (p == nullptr || *p == tail) return;
+
+    NodePtr node = unlink(p, previous);
+
+    link(&Policy::next(tail), tail, node);
+}
+
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element>
 ListBase<Element, Policy> &ListBase<Element, Policy>::operator=(ListBase &&other) noexcept {
@@ -143,9 +328,11 @@ ListBase<Element, Policy> &ListBase<Element, Policy>::operator=(ListBase &&other
 
         head = other.head;
         length = other.length;
+        tail = other.tail;
 
         other.head = nullptr;
         other.length = 0;
+        other.tail = nullptr;
     }
 
     return *this;
@@ -155,6 +342,7 @@ template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element>
 Element *ListBase<Element, Policy>::operator[](size_t index) const noexcept {
     if (index >= length) return nullptr;
+    if (index == length - 1) return Policy::extract(tail);
 
     NodePtr p = head;
 
@@ -163,27 +351,54 @@ Element *ListBase<Element, Policy>::operator[](size_t index) const noexcept {
     return Policy::extract(p);
 }
 
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+void ListBase<Element, Policy>::relink() noexcept {
+    NodePtr p, previous = nullptr;
+
+    for (p = head; p; previous = p, p = Policy::next(p)) {
+        if constexpr (DoublyLinkedPolicy<Policy>) Policy::prev(p) = previous;
+    }
+
+    tail = previous;
+}
+
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element>
 template<typename Compare>
 void ListBase<Element, Policy>::sort(Compare compare) noexcept {
-    NodePtr *min, *p, *q, t;
+    if (length < 2) return;
 
-    // selection sort for simplicity
-    for (p = &head; *p; p = &Policy::next(*p)) {
-        // Find the pointer-to-pointer holding the minimal node.
-        min = p;
-        
-        for (q = &Policy::next(*p); *q; q = &Policy::next(*q)) {
-            if (compare(Policy::extract(*q), Policy::extract(*min))) min = q;
-        }
+    // merge adjacent runs of width, doubling width each pass until one run remains
+    for (size_t width = 1; width < length; width *= 2) {
+        NodePtr *link = &head, remaining = head;
+
+        while (remaining) {
+            NodePtr a = remaining, b = splitRun(a, width), last;
 
-        if (min != p) {
-            t = *p;
-            *p = *min;
-            *min = t;
+            remaining = splitRun(b, width);
+
+            *link = mergeRuns(a, b, compare, last);
+            link = &Policy::next(last);
         }
     }
+
+    relink();
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+typename ListBase<Element, Policy>::NodePtr ListBase<Element, Policy>::splitRun(NodePtr node, size_t count) noexcept {
+    NodePtr rest;
+
+    if (!node) return nullptr;
+
+    while (--count && Policy::next(node)) node = Policy::next(node);
+
+    rest = Policy::next(node);
+    Policy::next(node) = nullptr;
+
+    return rest;
 }
 
 template<typename Element, typename Policy>
@@ -196,4 +411,28 @@ void ListBase<Element, Policy>::swap(ListBase &other) noexcept {
     size_t l = length;
     length = other.length;
     other.length = l;
+
+    NodePtr t = tail;
+    tail = other.tail;
+    other.tail = t;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element>
+typename ListBase<Element, Policy>::NodePtr ListBase<Element, Policy>::unlink(NodePtr *link, NodePtr previous) noexcept {
+    NodePtr node = *link;
+
+    *link = Policy::next(node);
+
+    if constexpr (DoublyLinkedPolicy<Policy>) {
+        if (*link) Policy::prev(*link) = previous;
+        Policy::prev(node) = nullptr;
+    }
+
+    if (tail == node) tail = previous;
+
+    Policy::next(node) = nullptr;
+    --length;
+
+    return node;
 }
@@ -20,8 +20,25 @@
 
 #ifdef __cplusplus
 
+#include <esp_timer.h>
+
+#include "atomic.h"
 #include "color.h"
 #include "lock.h"
+#include "logRing.h"
+
+// LOG_MINIMUM_LEVEL is the lowest Log::Level compiled into a file's logX() calls, those
+// below it compile to nothing, arguments included. It follows ESP-IDF's LOG_LOCAL_LEVEL
+// unless it's defined, so a file can set either one ahead of its #includes.
+#ifndef LOG_MINIMUM_LEVEL
+#define LOG_MINIMUM_LEVEL           Log::Level(ESP_LOG_VERBOSE - LOG_LOCAL_LEVEL)
+#endif
+#ifndef LOG_RATE_LIMIT_BURST
+#define LOG_RATE_LIMIT_BURST        5       // messages a call site may log back to back
+#endif
+#ifndef LOG_RATE_LIMIT_INTERVAL_MS
+#define LOG_RATE_LIMIT_INTERVAL_MS  1000    // after a burst, one message per interval
+#endif
 
 #define logd(_format, ...)          logDebug(_format, ##__VA_ARGS__)    
 #define loge(_format, ...)          logError(_format, ##__VA_ARGS__)
@@ -29,23 +46,59 @@
 #define logv(_format, ...)          logVerbose(_format, ##__VA_ARGS__)
 #define logw(_format, ...)          logWarning(_format, ##__VA_ARGS__)
 
-// these logging methods send the log over the wire to AWS in addition to logging to the console
-#define logDebug(_format, ...)      do { _logd(_format, ##__VA_ARGS__); Log::shared().log(Log::Level::debug, __FILE_NAME__, _format, ##__VA_ARGS__); } while (0)
-#define logError(_format, ...)      do { _loge(_format, ##__VA_ARGS__); Log::shared().log(Log::Level::error, __FILE_NAME__, _format, ##__VA_ARGS__); } while (0)
-#define logInfo(_format, ...)       do { _logi(_format, ##__VA_ARGS__); Log::shared().log(Log::Level::info, __FILE_NAME__, _format, ##__VA_ARGS__); } while (0)
-#define logVerbose(_format, ...)    do { _logv(_format, ##__VA_ARGS__); Log::shared().log(Log::Level::verbose, __FILE_NAME__, _format, ##__VA_ARGS__); } while (0)
-#define logWarning(_format, ...)    do { _logw(_format, ##__VA_ARGS__); Log::shared().log(Log::Level::warning, __FILE_NAME__, _format, ##__VA_ARGS__); } while (0)
+// these logging methods send the log over the wire to AWS in addition to logging to the console.
+// The console line is written synchronously, the rest is deferred to the log task (see Log).
+// Each call site is rate limited by its own LogLimiter, see _logLimited().
+#define logDebug(_format, ...)      _logLimited(debug, _logd, _format, ##__VA_ARGS__)
+#define logError(_format, ...)      _logLimited(error, _loge, _format, ##__VA_ARGS__)
+#define logInfo(_format, ...)       _logLimited(info, _logi, _format, ##__VA_ARGS__)
+#define logVerbose(_format, ...)    _logLimited(verbose, _logv, _format, ##__VA_ARGS__)
+#define logWarning(_format, ...)    _logLimited(warning, _logw, _format, ##__VA_ARGS__)
+
+// The limiter is a function static with a constexpr constructor, so it's constant
+// initialized: no guard variable, no registration, no lookup, just allow(). The format
+// isn't part of that, so a format held in a variable works too. allow() only gets it for
+// the repeat report when it's a literal, another may not outlive the suppression. Levels
+// below LOG_MINIMUM_LEVEL drop out at compile time, as does the ring record for levels that
+// are never published. Log::log() is a template so its format can't be checked, the console
+// call checks it instead, which the compiler does even in a discarded if constexpr.
+#define _logLimited(_level, _console, _format, ...) do { \
+    if constexpr (Log::Level::_level >= LOG_MINIMUM_LEVEL) { \
+        static constinit LogLimiter _limiter(Log::Level::_level, __FILE_NAME__); \
+        if (_limiter.allow(__builtin_constant_p(_format) ? _format : nullptr)) { \
+            _console(_format, ##__VA_ARGS__); \
+            if constexpr (Log::Level::_level >= Log::publishedLevel) { \
+                Log::shared().log(Log::Level::_level, __FILE_NAME__, _format, ##__VA_ARGS__); \
+            } \
+        } \
+    } \
+} while (0)
 
 #define setErr(_expr)               do { if ((err = (_expr))) logError("error %d at %s():%d", err, __FUNCTION__, __LINE__); } while (0)
 #define setErrFmt(_expr, _fmt, ...) do { if ((err = (_expr))) logError("error %d at %s():%d: " _fmt, err, __FUNCTION__, __LINE__, ##__VA_ARGS__); } while (0)
 #define setErrMsg(_expr, _msg)      do { if ((err = (_expr))) logError("error %d at %s():%d: %s", err, __FUNCTION__, __LINE__, (_msg)); } while (0)
 
+// Log defers everything but the console to a background task. log() copies the format
+// pointer, level, tag, timestamp and raw arguments into a LogRing record and returns, a
+// few hundred cycles with no locks, heap or formatting. The log task then formats each
+// record, renders it to the display and serializes it to EventReporter in batches.
+//
+// Formats are read by the log task, so one that isn't a string literal must stay valid
+// until its record has been published. logX() formats are literals in any case, ESP-IDF's
+// console macros paste them into their prefix. String arguments are copied. If the ring
+// is full the record is dropped, the log task reports how many were.
+// Until init() starts the log task, records are published synchronously by the caller.
 class Log {
 
+    friend class LogLimiter;
+
 public:
 
     enum Level { verbose, debug, info, warning, error };
 
+    // the lowest level published to EventReporter, see log()
+    static const Level          publishedLevel = info;
+
     Log(Log const &) = delete;
    ~Log();
 
@@ -54,7 +107,10 @@ public:
     // 2020.12.08 bd: a design note here.  I'm abusing log such that levels >= info are published to
     // EventReporter. Anything with a level less than info will be ignored (though it can be output to
     // the console with log[dv]).
-    void                        log(Level level, const char *tag, const char *format, ...);
+    template<typename... Args>
+    void                        log(Level level, const char *tag, const char *format, Args... args);
+    // log() with a cJSON publishes root as the log's "data" by reference, without printing
+    // it, synchronously on the calling task. It doesn't go to the console or the display.
     void                        log(const cJSON *root, Level level = Level::info, const char *tag = __FILE_NAME__);
     void                        operator=(Log const &) = delete;
 
@@ -62,29 +118,164 @@ public:
 
 private:
 
+    struct Writer;
+
+    // records taken per wake-up of the log task before it yields
+    static const size_t         batchSize = 8;
+
     Log() = default;
 
-    cJSON *                     createJSON(Level level, const char *tag, const char *format, ...);
-    cJSON *                     createJSON(Level level, const char *tag, const char *format, va_list args);
-    void                        log(Level level, const char *tag, const char *format, va_list args);
+    // createJSON() takes a message, data or both. data is added by reference, not copied.
+    cJSON *                     createJSON(Level level, const char *tag, double when, const char *message, const cJSON *data = nullptr);
+    // drain() publishes everything committed to the ring. Only one task drains at a time.
+    void                        drain();
+    void                        publish(Level level, const char *tag, double when, const char *message);
+    void                        wake();
 
+    uint32_t                    droppedReported = 0;
+    Lock                        drainLock;
+    LogRing                     ring;
     char *                      topic = nullptr;
+    Writer *                    writer = nullptr;
 
 #if ENABLE_LOGGING_TO_SPIFFS
+    // The log files on spiffs, scanned once by findLogFiles() and then kept up to date as
+    // files are written, rolled over and deleted, so logging never has to list the directory.
+    struct LogFiles {
+        int                     bytes = 0;              // the total size of the log files
+        int                     count = 0;
+        int                     high = 0;
+        int                     highBytes = 0;          // the size of log file high
+        bool                    isIndexed = false;
+        int                     low = 0;
+    };
+
     err_t                       findLogFiles(int &count, int &high, int &low, int &totalLogfilesBytesUsed);
-    int                         logHandler(const char *format, va_list args);
-    int                         logToSystemLog(const char *format, ...);
+    // flushLogFile() writes out whatever writeLogFile() has buffered. Call with lock held.
+    err_t                       flushLogFile();
+    // flushStaleLogFile() flushes if the oldest buffered message has waited LOGFILE_FLUSH_INTERVAL_MS
+    void                        flushStaleLogFile();
+    err_t                       indexLogFiles();
+    int                         logHandler(const char *format, va_list args) __attribute__((format(printf, 2, 0)));
+    int                         logToSystemLog(const char *format, ...) __attribute__((format(printf, 2, 3)));
     err_t                       openLogFile(bool forceNextHighestLogFileNumber = false);
+    // recoverLogFile() writes out a buffer left unflushed by a panic or watchdog reset
+    void                        recoverLogFile();
+    void                        unlinkOldestLogFile();
+    // writeLogFile() buffers message in RTC memory, it reaches spiffs on the next flush
     err_t                       writeLogFile(const char *message);
 
-    static int                  logOverride(const char *format, va_list args);
+    static int                  logOverride(const char *format, va_list args) __attribute__((format(printf, 1, 0)));
+    static void                 shutdownHandler();
 
+    int64_t                     bufferedAt = 0;         // when the oldest buffered message was written
     int                         file = -1;
     bool                        isBootupLogFile = true;
     RecursiveLock               lock;
+    LogFiles                    logFiles;
     vprintf_like_t              systemLogHandler = nullptr;
 #endif
 
 };
 
+// LogLimiter is the token bucket behind each logX() call site. A site may log
+// LOG_RATE_LIMIT_BURST messages back to back, then one per LOG_RATE_LIMIT_INTERVAL_MS;
+// anything more is counted instead of logged. The count goes out as "last message repeated
+// N times" ahead of the site's next message, or from the log task once the site goes quiet.
+//
+// The bucket is kept as the time the site's next message is due (GCRA), so allow() is a
+// clock read and one CAS on a 32 bit word, with no lock. Limiters that have suppressed
+// anything are linked onto a list for the log task, they're never unlinked since call
+// sites live forever.
+class LogLimiter {
+
+    friend class Log;
+
+public:
+
+    constexpr LogLimiter(Log::Level level, const char *tag) : level(level), tag(tag) { }
+    LogLimiter(LogLimiter const &) = delete;
+
+    void                        operator=(LogLimiter const &) = delete;
+
+    // allow() returns true if the site may log now, reporting what it suppressed first.
+    // format is quoted in the report, nullptr leaves it out.
+    bool                        allow(const char *format);
+
+private:
+
+    static const uint32_t       burst = LOG_RATE_LIMIT_BURST;
+    static const uint32_t       interval = LOG_RATE_LIMIT_INTERVAL_MS;
+    static const int32_t        window = int32_t(burst * interval);
+
+    // isAllowed() is true if a message due at due may go out at now. A site is never
+    // legitimately more than window ahead, further means the 32 bit clock wrapped past it.
+    static bool                 isAllowed(uint32_t due, uint32_t now) {
+        int32_t ahead = int32_t(due - now);
+
+        return ahead <= window - int32_t(interval) || ahead > window;
+    }
+    static uint32_t             now() { return uint32_t(esp_timer_get_time() / 1000); }
+    // reportSuppressed() is the log task's half: it reports the sites whose burst has
+    // ended and returns true if any are still suppressing.
+    static bool                 reportSuppressed();
+
+    void                        report(uint32_t count);
+    void                        startSuppressing(const char *format);
+
+    static Atomic<LogLimiter *> suppressing;            // every limiter that has suppressed, linked through next
+
+    Atomic<uint32_t>            dueAt;                  // ms, when the bucket is full this is in the past
+    Atomic<const char *>        format;                 // as given to allow() when suppressing started
+    Atomic<bool>                isListed;
+    Log::Level                  level;
+    LogLimiter *                next = nullptr;
+    Atomic<uint32_t>            suppressed;
+    const char *                tag;
+
+};
+
+inline bool LogLimiter::allow(const char *format) {
+    uint32_t time = now();
+    uint32_t due = dueAt.load(MemoryOrder::relaxed), next;
+
+    do {
+        if (!isAllowed(due, time)) {
+            if (suppressed.fetchAdd(1, MemoryOrder::relaxed) == 0) startSuppressing(format);
+            return false;
+        }
+
+        int32_t ahead = int32_t(due - time);
+
+        // a site that has been idle starts over from now
+        next = (ahead < 0 || ahead > window ? time : due) + interval;
+    } while (!dueAt.compareExchangeWeak(due, next, MemoryOrder::relaxed));
+
+    if (suppressed.load(MemoryOrder::relaxed)) {
+        uint32_t count = suppressed.exchange(0, MemoryOrder::relaxed);
+
+        if (count) report(count);
+    }
+
+    return true;
+}
+
+template<typename... Args>
+void Log::log(Level level, const char *tag, const char *format, Args... args) {
+    if (format == nullptr || level < publishedLevel) return;
+
+    LogRing::Record *record = ring.claim();
+
+    if (record == nullptr) return;
+
+    record->format = format;
+    record->level = uint8_t(level);
+    record->tag = tag;
+    record->timestamp = esp_timer_get_time();
+
+    (record->put(args), ...);
+
+    if (ring.commit(record)) wake();
+}
+
 #endif // __cplusplus
@@ -0,0 +1,172 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+
+#include "atomic.h"
+
+#ifndef LOG_RING_CAPACITY
+#define LOG_RING_CAPACITY           32      // records, a power of two
+#endif
+#ifndef LOG_RING_RECORD_SIZE
+#define LOG_RING_RECORD_SIZE        128     // bytes per record, header included
+#endif
+
+// LogRing is a fixed capacity, lock-free ring of log records for any number of producers
+// and a single consumer. A producer claim()s a record, fills it in place and commit()s it,
+// the consumer takes records in claim order with front() and pop(). When the ring is full
+// claim() returns nullptr and the record is counted as dropped, a logging call never waits.
+//
+// Each slot carries a sequence number (Vyukov's bounded queue), so producers only contend
+// on the single CAS that claims a slot. A producer preempted between claim() and commit()
+// holds up the consumer at that record until it commits; records behind it wait too.
+//
+// A record holds the format string pointer rather than the formatted message, plus each
+// argument's raw bytes tagged with its type. Formatting is left to the consumer, see
+// LogRing::Record::render(). String arguments are copied since they may not outlive the
+// call, everything else is stored by value.
+class LogRing {
+
+public:
+
+    static const size_t         capacity = LOG_RING_CAPACITY;
+
+    struct Record {
+        enum class Type : uint8_t { int32, int64, pointer, real, string };
+
+        static const size_t     dataSize = LOG_RING_RECORD_SIZE - 2 * sizeof(const char *) - sizeof(int64_t) - 8;
+
+        // render() formats the record into buffer as snprintf(buffer, size, format, ...)
+        // would have at the call site, always NUL terminated. Arguments that didn't fit in
+        // the record are shown as "?". Returns the length written.
+        size_t                  render(char *buffer, size_t size) const;
+
+        template<typename T>
+        void                    put(T value) {
+            using Value = std::decay_t<T>;
+
+            if constexpr (std::is_same_v<Value, char *> || std::is_same_v<Value, const char *>) {
+                putString(value);
+            } else if constexpr (std::is_enum_v<Value>) {
+                put(std::underlying_type_t<Value>(value));
+            } else if constexpr (std::is_floating_point_v<Value>) {
+                double real = value;
+                putBytes(Type::real, &real, sizeof(real));
+            } else if constexpr (std::is_pointer_v<Value> || std::is_null_pointer_v<Value>) {
+                const void *pointer = value;
+                putBytes(Type::pointer, &pointer, sizeof(pointer));
+            } else if constexpr (std::is_integral_v<Value> && sizeof(Value) > sizeof(int32_t)) {
+                int64_t word = int64_t(value);
+                putBytes(Type::int64, &word, sizeof(word));
+            } else {
+                static_assert(std::is_integral_v<Value>, "log arguments must be numbers, pointers or strings");
+                int32_t word = int32_t(value);
+                putBytes(Type::int32, &word, sizeof(word));
+            }
+        }
+
+        const char *            format = nullptr;
+        const char *            tag = nullptr;
+        int64_t                 timestamp = 0;          // esp_timer_get_time()
+        uint8_t                 level = 0;
+        uint8_t                 length = 0;             // bytes of data used
+        bool                    isTruncated = false;
+        uint32_t                sequence = 0;           // owned by LogRing
+        uint8_t                 data[dataSize];
+
+    private:
+
+        void                    putBytes(Type type, const void *bytes, size_t size);
+        void                    putString(const char *string);
+    };
+
+    static_assert(sizeof(Record) <= LOG_RING_RECORD_SIZE, "LOG_RING_RECORD_SIZE doesn't fit the record header");
+    static_assert((capacity & (capacity - 1)) == 0, "LOG_RING_CAPACITY must be a power of two");
+
+    LogRing();
+    LogRing(LogRing const &) = delete;
+
+    void                        operator=(LogRing const &) = delete;
+
+    // producer side, safe from any task
+    Record *                    claim();
+    // commit() publishes record, returning true if the consumer may need waking
+    bool                        commit(Record *record);
+
+    // consumer side
+    Record *                    front();
+    uint32_t                    getDropped() const { return dropped.load(MemoryOrder::relaxed); }
+    void                        pop();
+    // takeWake() clears the wake flag, call it before draining so a commit() racing the
+    // drain asks for another wake-up
+    void                        takeWake() { isWakePending.store(false, MemoryOrder::seqCst); }
+
+private:
+
+    Atomic<uint32_t>            dropped;
+    uint32_t                    head = 0;               // next slot read, owned by the consumer
+    Atomic<bool>                isWakePending;
+    Record                      records[capacity];
+    Atomic<uint32_t>            tail;                   // next slot claimed
+
+};
+
+inline LogRing::LogRing() {
+    for (uint32_t i = 0; i < capacity; ++i) records[i].sequence = i;
+}
+
+inline LogRing::Record *LogRing::claim() {
+    uint32_t position = tail.load(MemoryOrder::relaxed);
+
+    for (;;) {
+        Record *record = &records[position & (capacity - 1)];
+        int32_t difference = int32_t(AtomicRef<uint32_t>(record->sequence).load(MemoryOrder::acquire) - position);
+
+        if (difference == 0) {
+            if (tail.compareExchangeWeak(position, position + 1, MemoryOrder::relaxed)) {
+                record->length = 0;
+                record->isTruncated = false;
+                return record;
+            }
+        } else if (difference < 0) {
+            // the consumer hasn't freed this slot yet, the ring is full
+            dropped.fetchAdd(1, MemoryOrder::relaxed);
+            return nullptr;
+        } else {
+            position = tail.load(MemoryOrder::relaxed);
+        }
+    }
+}
+
+inline bool LogRing::commit(Record *record) {
+    uint32_t position = record->sequence;
+
+    AtomicRef<uint32_t>(record->sequence).store(position + 1, MemoryOrder::release);
+
+    // seqCst pairs with takeWake(), either the consumer sees this record or this sees the flag clear
+    return !isWakePending.exchange(true, MemoryOrder::seqCst);
+}
+
+inline LogRing::Record *LogRing::front() {
+    Record *record = &records[head & (capacity - 1)];
+
+    if (AtomicRef<uint32_t>(record->sequence).load(MemoryOrder::acquire) != head + 1) return nullptr;
+
+    return record;
+}
+
+inline void LogRing::pop() {
+    Record *record = &records[head & (capacity - 1)];
+
+    AtomicRef<uint32_t>(record->sequence).store(head + capacity, MemoryOrder::release);
+
+    ++head;
+}
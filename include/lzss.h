@@ -0,0 +1,44 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "err_t.h"
+
+// LZSS is a small LZ77 block compressor in the heatshrink/Okumura mould, for log text.
+// It needs no tables or heap, only the source and destination buffers, and each block
+// decodes on its own.
+//
+// A block is a run of groups, each a flag byte followed by up to 8 items. Flag bit i
+// (least significant first) says whether item i is a literal byte (0) or a match (1).
+// A match is a little endian 16 bit token: the high 10 bits are the distance back minus 1
+// (1 - 1024), the low 6 bits are the length minus 3 (3 - 66). A match may overlap the
+// bytes it produces, so copy it a byte at a time.
+//
+// compress() searches the whole window for the longest match. That is O(size * window)
+// in the worst case, fine for the 1KB log blocks it's used on.
+class LZSS {
+
+public:
+
+    static const size_t         windowSize = 1024;
+    static const size_t         minMatch = 3;
+    static const size_t         maxMatch = 66;
+
+    // compress() returns the compressed length, or 0 if it wouldn't fit in capacity
+    static size_t               compress(const void *source, size_t size, void *destination, size_t capacity);
+    // decompress() returns EBADMSG if source isn't a valid block, ENOSPC if it doesn't fit
+    static err_t                decompress(const void *source, size_t size, void *destination, size_t capacity, size_t &length);
+
+private:
+
+    static const unsigned       lengthBits = 6;
+
+    LZSS() = delete;
+
+};
@@ -0,0 +1,170 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "list.h"
+#include "retainedList.h"
+
+// MARK: - MPSCQueue
+
+// MPSCQueue is a lock-free, intrusive, multi-producer single-consumer FIFO. Any number of
+// tasks or ISRs may push() concurrently without blocking. Only one consumer may pop at a
+// time; consumers that share a queue must serialize themselves (e.g. with a portMUX).
+//
+// Producers push onto a Treiber stack with a single CAS. The consumer takes the whole
+// stack with one exchange and reverses it into arrival order, so there is no ABA hazard
+// and each element costs O(1) amortized on both sides.
+//
+// Elements are linked through the policy's next(), ListElement<T>::next by default, so an
+// element can't be on an MPSCQueue and an intrusive List through the same hook at once.
+// With a RetainedPolicy, push() retains the element and drain() releases it.
+template<typename Element, typename Policy = IntrusivePolicy<Element>>
+requires ListNodePolicy<Policy, Element> && (Policy::isIntrusive)
+class MPSCQueue {
+
+public:
+
+    using NodePtr = typename Policy::NodePtr;
+
+    MPSCQueue() noexcept = default;
+    MPSCQueue(const MPSCQueue &) = delete;
+   ~MPSCQueue() noexcept;
+
+    MPSCQueue &                 operator=(const MPSCQueue &) = delete;
+
+    // Callback: (Element *e) -> void
+    // drain() pops up to maxCount elements, calling callback for each in arrival order.
+    // For retained policies each element is released after its callback returns.
+    template<typename Callback>
+    size_t                      drain(Callback &&callback, size_t maxCount = SIZE_MAX) noexcept;
+    bool                        isEmpty() const noexcept;
+    // pop() returns the oldest element or nullptr. For retained policies the caller takes
+    // over the queue's reference and must release it.
+    Element *                   pop() noexcept;
+    // popAll() takes everything queued so far and returns it as a chain in arrival order,
+    // linked through the policy's next() and terminated by nullptr. References transfer
+    // as for pop().
+    NodePtr                     popAll() noexcept;
+    // push() is safe from any task or ISR. It returns true if the producer stack was empty,
+    // i.e. this is the first push since the consumer last collected. The consumer may still
+    // hold older elements it hasn't popped, so true only means a consumer that pops until
+    // nullptr before sleeping has to be woken. fifo isn't checked, it's the consumer's.
+    bool                        push(Element *e) noexcept;
+
+private:
+
+    static constexpr bool       isRetained = requires { requires Policy::isRetained; };
+
+    // moves everything pushed so far onto the end of fifo
+    void                        collect() noexcept;
+
+    NodePtr                     fifo = nullptr;         // consumer owned, arrival order
+    NodePtr                     fifoTail = nullptr;
+    NodePtr                     stack = nullptr;        // producers push here, newest first
+
+};
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && (Policy::isIntrusive)
+MPSCQueue<Element, Policy>::~MPSCQueue() noexcept {
+    drain([](Element *) { });
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && (Policy::isIntrusive)
+void MPSCQueue<Element, Policy>::collect() noexcept {
+    NodePtr node = __atomic_exchange_n(&stack, nullptr, __ATOMIC_ACQUIRE);
+    NodePtr reversed = nullptr, tail = node;
+
+    while (node) {
+        NodePtr next = Policy::next(node);
+
+        Policy::next(node) = reversed;
+        reversed = node;
+        node = next;
+    }
+
+    if (!reversed) return;
+
+    if (fifoTail) Policy::next(fifoTail) = reversed;
+    else fifo = reversed;
+
+    fifoTail = tail;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && (Policy::isIntrusive)
+template<typename Callback>
+size_t MPSCQueue<Element, Policy>::drain(Callback &&callback, size_t maxCount) noexcept {
+    Element *e;
+    size_t count = 0;
+
+    while (count < maxCount && (e = pop()) != nullptr) {
+        callback(e);
+
+        if constexpr (isRetained) e->release();
+
+        ++count;
+    }
+
+    return count;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && (Policy::isIntrusive)
+bool MPSCQueue<Element, Policy>::isEmpty() const noexcept {
+    return fifo == nullptr && __atomic_load_n(&stack, __ATOMIC_RELAXED) == nullptr;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && (Policy::isIntrusive)
+Element *MPSCQueue<Element, Policy>::pop() noexcept {
+    if (!fifo) collect();
+    if (!fifo) return nullptr;
+
+    NodePtr node = fifo;
+
+    if ((fifo = Policy::next(node)) == nullptr) fifoTail = nullptr;
+
+    Policy::next(node) = nullptr;
+
+    return Policy::extract(node);
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && (Policy::isIntrusive)
+typename MPSCQueue<Element, Policy>::NodePtr MPSCQueue<Element, Policy>::popAll() noexcept {
+    collect();
+
+    NodePtr chain = fifo;
+
+    fifo = fifoTail = nullptr;
+
+    return chain;
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && (Policy::isIntrusive)
+bool MPSCQueue<Element, Policy>::push(Element *e) noexcept {
+    if constexpr (isRetained) e->retain();
+
+    NodePtr node = Policy::createNode(e);
+    NodePtr head = __atomic_load_n(&stack, __ATOMIC_RELAXED);
+
+    do {
+        Policy::next(node) = head;
+    } while (!__atomic_compare_exchange_n(&stack, &head, node, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return head == nullptr;
+}
+
+// MARK: - Aliases
+
+template<typename Element>
+using RetainedMPSCQueue = MPSCQueue<Element, IntrusiveRetainedPolicy<Element>>;
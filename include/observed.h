@@ -6,6 +6,7 @@
 #pragma once
 
 #include "common.h"
+#include "ref.h"
 
 class Observed :
     public ReferenceCounted<Observed>
@@ -16,6 +17,10 @@ public:
     struct Message : public ReferenceCounted<Message> {
         Message(uint32_t tag, UnixTime when = getCurrentTime());
 
+        // getValue() exposes a message's numeric value to observer filters. Messages
+        // without one return false and are never held back by a deadband.
+        virtual bool            getValue(double &value) const { return false; }
+
         uint32_t                tag;
         UnixTime                when;
     };
@@ -23,22 +28,73 @@ public:
     // Observer callbacks should not block the caller. This is guidance for
     // performance and responsiveness: callbacks are invoked sequentially
     // by notifyObservers(). It is not a strict requirement for correctness.
+    // A slow observer should ask for queued delivery instead, see Delivery.
     typedef void (*ObserverCallback)(Observed *observed, void *context, const Message *message);
 
+    // What a queued observer's full queue does with another message.
+    //  - dropNewest discards the incoming message.
+    //  - dropOldest discards the oldest queued message.
+    //  - latestValueWins replaces a queued message with the same tag (a newer reading
+    //    supersedes an undelivered one), otherwise behaves like dropOldest.
+    enum class Backpressure : uint8_t { dropNewest, dropOldest, latestValueWins };
+
+    // With a task, messages are queued (retained) and the callback is called on that task,
+    // so notifyObservers() never waits on the observer. Without one the callback is called
+    // synchronously from notifyObservers().
+    struct Delivery {
+        Backpressure            backpressure = Backpressure::latestValueWins;
+        uint8_t                 queueDepth = 4;
+        DispatchTask *          task = nullptr;
+    };
+
+    // coalesced and dropped only apply to queued observers
+    struct DeliveryStatistics {
+        uint32_t                coalesced = 0;          // replaced by a newer message with the same tag
+        uint32_t                delivered = 0;
+        uint32_t                dropped = 0;
+        uint32_t                filtered = 0;           // held back by the observer's Filter
+    };
+
+    // A Filter is applied by notifyObservers() before the callback is called or the message
+    // is queued, so an observer only sees what it asked for. A default Filter passes everything.
+    //  - hasTag: only messages with this tag pass.
+    //  - deadband: a value within deadband of the last value passed is held back. When
+    //    isDeadbandRelative, deadband is a fraction of that value (0.01 is 1%).
+    //  - minimumIntervalMs: nothing passes sooner than this after the last message passed.
+    //  - maximumSilenceMs: a message the deadband would hold back passes anyway once this
+    //    long has gone by without one passing, a heartbeat for a steady value. 0 disables it.
+    struct Filter {
+        double                  deadband = 0;
+        bool                    hasTag = false;
+        bool                    isDeadbandRelative = false;
+        uint32_t                maximumSilenceMs = 0;
+        uint32_t                minimumIntervalMs = 0;
+        uint32_t                tag = 0;
+    };
+
     // An observer cannot add itself more than once to an Observed
     // instance. Calling addObserver() when the context is already
     // an observer will result in EALREADY being returned.
     //
-    // Warning: Due to the way observers are cached, it's possible
-    // for an ObserverCallback to be in flight when removeObserver()
-    // is called, or potentially called after removeObserver() returns
-    // if the observer is removed from somewhere other than the ObserverCallback.
-    // Removing the observer from within the ObserverCallback guarantees the
-    // callback will not be called again during the same notify pass.
+    // Warning: notifyObservers() works from a snapshot of the observers,
+    // so it's possible for an ObserverCallback to be in flight when
+    // removeObserver() is called, or potentially called after removeObserver()
+    // returns if the observer is removed from somewhere other than the
+    // ObserverCallback. Removing the observer from within its ObserverCallback
+    // guarantees the callback will not be called again during the same notify pass.
     template<Retainable T>
     err_t                       addObserver(T *context, ObserverCallback callback);
+    template<Retainable T>
+    err_t                       addObserver(T *context, ObserverCallback callback, const Delivery &delivery);
+    template<Retainable T>
+    err_t                       addObserver(T *context, ObserverCallback callback, const Filter &filter);
+    template<Retainable T>
+    err_t                       addObserver(T *context, ObserverCallback callback, const Filter &filter, const Delivery &delivery);
+    // returns ENOENT if context isn't an observer
+    template<Retainable T>
+    err_t                       getDeliveryStatistics(T *context, DeliveryStatistics &statistics);
 
-    bool                        isObserved() const { return observersCount > 0; }
+    bool                        isObserved() const { return __atomic_load_n(&snapshot, __ATOMIC_RELAXED) != nullptr; }
 
     template<Retainable T>
     void                        removeObserver(T *context);
@@ -48,97 +104,109 @@ protected:
     Observed() = default;
     virtual ~Observed();
 
-    // As a convenience to the caller, notifyObservers() releases
-    // but does not retain message.
-    virtual void                notifyObservers(Message *message);
+    // notifyObservers() takes over message's reference, pass it with std::move (or
+    // straight from makeRef()) and the message is never retained on the way in.
+    virtual void                notifyObservers(Ref<Message> message);
 
 private:
 
-    struct Observer {
-        ObserverCallback        callback;
-        void *                  context;
-        ReleaseFunc             release;
-        RetainFunc              retain;
+    // An Observer retains its context for as long as any snapshot holds it.
+    // isRemoved lets a notify pass skip an observer removed after the pass
+    // took its snapshot. The queue fields are only used for queued delivery,
+    // queue is a ring of delivery.queueDepth messages. stateLock guards the
+    // queue, the filter state and statistics.
+    struct Observer : public ReferenceCounted<Observer> {
+        ObserverCallback        callback = nullptr;
+        void *                  context = nullptr;
+        Delivery                delivery;
+        Filter                  filter;
+        bool                    hasPassed = false;      // lastPassedAt is valid
+        bool                    hasPassedValue = false; // lastPassedValue is valid
+        bool                    isFiltered = false;     // filter isn't the default
+        volatile bool           isRemoved = false;
+        bool                    isScheduled = false;    // a drain is queued on delivery.task
+        int64_t                 lastPassedAt = 0;
+        double                  lastPassedValue = 0;
+        Message **              queue = nullptr;
+        uint8_t                 queueCount = 0;
+        uint8_t                 queueHead = 0;
+        ReleaseFunc             releaseContext = nullptr;
+        portMUX_TYPE            stateLock = portMUX_INITIALIZER_UNLOCKED;
+        DeliveryStatistics      statistics;
+
+    protected:
+
+       ~Observer() override;
+    };
+
+    // Snapshots are immutable. addObserver() and removeObserver() build a new
+    // one and swap it in, so a notify pass is a single retain plus iteration.
+    struct Snapshot : public ReferenceCounted<Snapshot> {
+        size_t                  count = 0;
+        Observer **             observers = nullptr;
+
+    protected:
+
+       ~Snapshot() override;
     };
 
-    Lock                        lock;
-    Observer *                  observers = nullptr;
-    size_t                      observersCount = 0;
+    void                        drain(Observer *observer);
+    void                        enqueue(Observer *observer, const Ref<Message> &message);
+    err_t                       getDeliveryStatisticsFor(void *context, DeliveryStatistics &statistics);
+    err_t                       insert(Ref<Observer> observer, const Filter &filter, const Delivery &delivery);
+    bool                        passes(Observer *observer, const Message *message);
+    void                        remove(void *context);
+    Ref<Snapshot>               retainSnapshot();
+    void                        swapSnapshot(Ref<Snapshot> newSnapshot);
+
+    Lock                        lock;                   // serializes snapshot writers
+    Snapshot *                  snapshot = nullptr;     // nullptr when there are no observers
+    portMUX_TYPE                snapshotLock = portMUX_INITIALIZER_UNLOCKED;
 
 };
 
 template<Retainable T>
 err_t Observed::addObserver(T *context, ObserverCallback callback) {
-    if (context == nullptr || callback == nullptr) return EINVAL;
-
-    err_t err = 0;
+    return addObserver(context, callback, Delivery());
+}
 
-    lock.lock();
+template<Retainable T>
+err_t Observed::addObserver(T *context, ObserverCallback callback, const Delivery &delivery) {
+    return addObserver(context, callback, Filter(), delivery);
+}
 
-    size_t i, n = observersCount;
-    Observer *newObservers;
+template<Retainable T>
+err_t Observed::addObserver(T *context, ObserverCallback callback, const Filter &filter) {
+    return addObserver(context, callback, filter, Delivery());
+}
 
-    for (i = 0; i < n; ++i) {
-        if (observers[i].context == context) {
-            setErr(EALREADY);
-            break;
-        }
-    }
+template<Retainable T>
+err_t Observed::addObserver(T *context, ObserverCallback callback, const Filter &filter, const Delivery &delivery) {
+    if (context == nullptr || callback == nullptr) return EINVAL;
 
-    if (!err) {
-        if ((newObservers = (Observer *) realloc(observers, sizeof(Observer) * (n + 1))) == nullptr) setErr(ENOMEM);
-        if (!err) {
-            context->retain();
+    Ref<Observer> observer = makeRef<Observer>();
 
-            observers = newObservers;
+    if (!observer) return ENOMEM;
 
-            observers[n].callback = callback;
-            observers[n].context = static_cast<void *>(context);
-            observers[n].release = [](void *ctx) -> size_t {
-                return static_cast<T *>(ctx)->release();
-            };
-            observers[n].retain = [](void *ctx) -> size_t {
-                return static_cast<T *>(ctx)->retain();
-            };
+    context->retain();
 
-            ++observersCount;
-        }
-    }
+    observer->callback = callback;
+    observer->context = static_cast<void *>(context);
+    observer->releaseContext = [](void *ctx) -> size_t {
+        return static_cast<T *>(ctx)->release();
+    };
 
-    lock.unlock();
+    return insert(std::move(observer), filter, delivery);
+}
 
-    return err;
+template<Retainable T>
+err_t Observed::getDeliveryStatistics(T *context, DeliveryStatistics &statistics) {
+    return getDeliveryStatisticsFor(static_cast<void *>(context), statistics);
 }
 
 template<Retainable T>
 void Observed::removeObserver(T *context) {
-    lock.lock();
-
-    bool found = false;
-    size_t i, n = observersCount;
-    Observer *newObservers;
-
-    for (i = 0; i < n; ++i) {
-        if (observers[i].context == context) {
-            observers[i].release(observers[i].context);
-            found = true;
-            break;
-        }
-    }
-
-    if (found) {
-        while (++i < n) observers[i - 1] = observers[i];
-        
-        if (--observersCount > 0) {
-            if ((newObservers = (Observer *) realloc(observers, sizeof(Observer) * observersCount)) != nullptr) {
-                observers = newObservers;
-            }
-        } else {
-            _free(observers);
-        }
-    }
-
-    lock.unlock();
+    remove(static_cast<void *>(context));
 }
 
 using ObservedMessage = Observed::Message;
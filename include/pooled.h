@@ -0,0 +1,79 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include <stddef.h>
+
+#include <new>
+
+#include <freertos/FreeRTOS.h>
+
+// Pooled gives T a class specific operator new and delete that recycle blocks through a
+// free list of up to capacity blocks, so a type allocated and freed at a steady rate stops
+// churning the heap. It is meant for ReferenceCounted types: release() deletes, which now
+// returns the block to the free list.
+//
+//      struct ReadingMessage : public Observed::Message, public Pooled<ReadingMessage, 8> { ... };
+//
+// Blocks are taken from the heap on demand, capacity only bounds how many idle blocks are
+// kept. Subclasses of T larger than T bypass the pool.
+template<typename T, size_t capacity>
+class Pooled {
+
+public:
+
+    static void *               operator new(size_t size) noexcept {
+        static_assert(sizeof(T) >= sizeof(Block), "a pooled type must be able to hold a free list link");
+
+        Block *block = nullptr;
+
+        if (size != sizeof(T)) return ::operator new(size, std::nothrow);
+
+        portENTER_CRITICAL(&lock);
+
+        if ((block = freeBlocks) != nullptr) {
+            freeBlocks = block->next;
+            --freeBlocksCount;
+        }
+
+        portEXIT_CRITICAL(&lock);
+
+        return block ? static_cast<void *>(block) : ::operator new(sizeof(T), std::nothrow);
+    }
+
+    static void                 operator delete(void *pointer, size_t size) {
+        bool isKept = false;
+
+        if (pointer == nullptr) return;
+
+        if (size == sizeof(T)) {
+            portENTER_CRITICAL(&lock);
+
+            if ((isKept = freeBlocksCount < capacity)) {
+                Block *block = static_cast<Block *>(pointer);
+
+                block->next = freeBlocks;
+                freeBlocks = block;
+                ++freeBlocksCount;
+            }
+
+            portEXIT_CRITICAL(&lock);
+        }
+
+        if (!isKept) ::operator delete(pointer);
+    }
+
+private:
+
+    struct Block {
+        Block *                 next;
+    };
+
+    static inline Block *       freeBlocks = nullptr;
+    static inline size_t        freeBlocksCount = 0;
+    static inline portMUX_TYPE  lock = portMUX_INITIALIZER_UNLOCKED;
+
+};
@@ -0,0 +1,81 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <utility>
+
+#include "retainable.h"
+
+// Ref holds one reference to a Retainable object and releases it when it goes away.
+//
+// Copying a Ref retains, moving one doesn't: the reference travels with the move, so
+// handing an object down a chain of calls by std::move costs no atomics at all. Objects
+// come from new with a count of 1, so adopt() takes over that reference instead of adding
+// another, and detach() hands the reference back as a raw pointer for storage that isn't
+// a Ref (a list node, an ISR queue, a malloc'ed array).
+//
+//      Ref<Message> message = makeRef<ReadingMessage>(value, when);
+//
+//      if (!message) return ENOMEM;
+//
+//      notifyObservers(std::move(message));
+//
+// A Ref is no more thread safe than a raw pointer: one Ref must not be written by one task
+// while another reads it. Separate Refs to the same object are fine on any task.
+template<Retainable T>
+class Ref {
+
+    template<Retainable U> friend class Ref;
+
+public:
+
+    Ref() noexcept = default;
+    Ref(std::nullptr_t) noexcept { }
+    // retains object
+    explicit Ref(T *object) noexcept : object(object) { if (object) object->retain(); }
+    Ref(const Ref &other) noexcept : Ref(other.object) { }
+    template<Retainable U> requires std::convertible_to<U *, T *>
+    Ref(const Ref<U> &other) noexcept : Ref(static_cast<T *>(other.object)) { }
+    Ref(Ref &&other) noexcept : object(other.detach()) { }
+    template<Retainable U> requires std::convertible_to<U *, T *>
+    Ref(Ref<U> &&other) noexcept : object(other.detach()) { }
+   ~Ref() { if (object) object->release(); }
+
+    // adopt() takes over a reference the caller already owns, e.g. from new, without a retain
+    static Ref                  adopt(T *object) noexcept { Ref ref; ref.object = object; return ref; }
+
+    // detach() gives up the reference without releasing it. The caller now owns it.
+    T *                         detach() noexcept { return std::exchange(object, nullptr); }
+    T *                         get() const noexcept { return object; }
+    // reset() releases the current object and retains the new one
+    void                        reset(T *newObject = nullptr) noexcept { Ref(newObject).swap(*this); }
+    void                        swap(Ref &other) noexcept { std::swap(object, other.object); }
+
+    // by value, so a copy retains and a move doesn't
+    Ref &                       operator=(Ref other) noexcept { swap(other); return *this; }
+
+    explicit                    operator bool() const noexcept { return object != nullptr; }
+    T &                         operator*() const noexcept { return *object; }
+    T *                         operator->() const noexcept { return object; }
+
+    friend bool                 operator==(const Ref &a, const Ref &b) noexcept { return a.object == b.object; }
+    friend bool                 operator==(const Ref &a, const T *b) noexcept { return a.object == b; }
+    friend bool                 operator==(const Ref &a, std::nullptr_t) noexcept { return a.object == nullptr; }
+
+private:
+
+    T *                         object = nullptr;
+
+};
+
+// makeRef() news a T and adopts it, so the Ref holds the only reference. It is empty if
+// the allocation failed.
+template<Retainable T, typename... Args>
+Ref<T> makeRef(Args &&...args) {
+    return Ref<T>::adopt(new T(std::forward<Args>(args)...));
+}
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <concepts>
+#include <cstddef>
 #include <utility>
 
 #include "atomicCounter.h"
@@ -50,16 +51,23 @@ ReferenceCounted<Derived>::ReferenceCounted()
 
 template<typename Derived>
 size_t ReferenceCounted<Derived>::release() const {
-    size_t value = --const_cast<ReferenceCounted *>(this)->counter;
+    // The value comes from the decrement itself: reading the counter again afterwards could
+    // see another task's release and delete twice. Each release publishes this task's writes
+    // to the object, and the acquire fence makes all of them visible to the one that deletes.
+    size_t value = const_cast<ReferenceCounted *>(this)->counter.fetchSub(1, MemoryOrder::release) - 1;
 
-    if (value == 0) delete this;
+    if (value == 0) {
+        atomicThreadFence(MemoryOrder::acquire);
+        delete this;
+    }
 
     return value;
 }
 
 template<typename Derived>
 size_t ReferenceCounted<Derived>::retain() const {
-    size_t value = ++const_cast<ReferenceCounted *>(this)->counter;
+    // a new reference can only come from an existing one, so there is nothing to order
+    size_t value = const_cast<ReferenceCounted *>(this)->counter.fetchAdd(1, MemoryOrder::relaxed) + 1;
 
     return value;
 }
@@ -5,7 +5,9 @@
 
 #pragma once
 
+#include "list.h"
 #include "listBase.h"
+#include "ref.h"
 #include "retainable.h"
 
 // MARK: - RetainedPolicy wrapper
@@ -17,6 +19,8 @@ struct RetainedPolicy : BasePolicy {
     using NodePtr = typename BasePolicy::NodePtr;
 
     static constexpr bool       isIntrusive = BasePolicy::isIntrusive;
+    // MPSCQueue retains on push() and releases on drain() when this is set
+    static constexpr bool       isRetained = true;
 
     static void                 destroy(NodePtr node) noexcept;
 };
@@ -48,16 +52,34 @@ public:
 
     // For intrusive lists, append() and insert() return void.
     // For non-intrusive lists, they return err_t (0 on success, ENOMEM on allocation failure).
+    // The Element * forms retain e. The Ref forms move e's reference into the list instead,
+    // which costs no atomics; if a non-intrusive list can't allocate a node, e keeps it.
     auto                        append(Element *e) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t>;
+    auto                        append(Ref<Element> &&e) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t>;
     auto                        insert(Element *e, size_t toIndex = 0) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t>;
+    auto                        insert(Ref<Element> &&e, size_t toIndex = 0) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t>;
 
     void                        clear() noexcept override;
+    // merge() moves every element of source into this list. Both lists must already be
+    // sorted by compare, the result is too. Equal elements from this list come first.
+    template<typename Compare>
+    void                        merge(RetainedList &source, Compare compare) noexcept;
     void                        remove(const Element *e) noexcept;
     void                        splice(size_t fromIndex, size_t toIndex) noexcept;
     void                        splice(RetainedList &source, Element *e, size_t toIndex) noexcept;
+    // sortedInsert() inserts e into a list sorted by compare, after any equal elements.
+    template<typename Compare>
+    auto                        sortedInsert(Element *e, Compare compare) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t>;
+    template<typename Compare>
+    auto                        sortedInsert(Ref<Element> &&e, Compare compare) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t>;
 
     RetainedList &              operator=(RetainedList &&) noexcept = default;
 
+private:
+
+    // adopt() makes a node for e, taking over its reference only once the node exists
+    NodePtr                     adopt(Ref<Element> &e) noexcept;
+
 };
 
 template<typename Element, typename Policy>
@@ -69,31 +91,38 @@ RetainedList<Element, Policy>::~RetainedList() noexcept {
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element> && Retainable<Element>
 auto RetainedList<Element, Policy>::append(Element *e) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t> {
+    return append(Ref<Element>(e));
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && Retainable<Element>
+auto RetainedList<Element, Policy>::append(Ref<Element> &&e) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t> {
     if (!e) {
         if constexpr (!Policy::isIntrusive) return 0;
         else return;
     }
 
-    e->retain();
-
-    NodePtr newNode = Policy::createNode(e);
-    NodePtr* p;
+    NodePtr newNode = adopt(e);
 
     if constexpr (!Policy::isIntrusive) {
-        if (!newNode) {
-            e->release();
-            return ENOMEM;
-        }
+        if (!newNode) return ENOMEM;
     }
 
-    for (p = &this->head; *p; p = &Policy::next(*p)) ;
+    this->link(this->tail ? &Policy::next(this->tail) : &this->head, this->tail, newNode);
 
-    *p = newNode;
-    ++this->length;
-    
     if constexpr (!Policy::isIntrusive) return 0;
 }
 
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && Retainable<Element>
+typename RetainedList<Element, Policy>::NodePtr RetainedList<Element, Policy>::adopt(Ref<Element> &e) noexcept {
+    NodePtr newNode = Policy::createNode(e.get());
+
+    if (newNode) e.detach();
+
+    return newNode;
+}
+
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element> && Retainable<Element>
 void RetainedList<Element, Policy>::clear() noexcept {
@@ -106,11 +135,18 @@ void RetainedList<Element, Policy>::clear() noexcept {
 
     this->head = nullptr;
     this->length = 0;
+    this->tail = nullptr;
 }
 
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element> && Retainable<Element>
 auto RetainedList<Element, Policy>::insert(Element *e, size_t toIndex) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t> {
+    return insert(Ref<Element>(e), toIndex);
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && Retainable<Element>
+auto RetainedList<Element, Policy>::insert(Ref<Element> &&e, size_t toIndex) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t> {
     if (!e) {
         if constexpr (!Policy::isIntrusive) return 0;
         else return;
@@ -118,65 +154,52 @@ auto RetainedList<Element, Policy>::insert(Element *e, size_t toIndex) noexcept
 
     if (toIndex > this->length) toIndex = this->length;
 
-    e->retain();
-    
-    NodePtr newNode = Policy::createNode(e);
-    NodePtr *p;
+    NodePtr newNode = adopt(e);
+    NodePtr previous, *p;
 
     if constexpr (!Policy::isIntrusive) {
-        if (!newNode) {
-            e->release();
-            return ENOMEM;
-        }
+        if (!newNode) return ENOMEM;
     }
     
-    for (p = &this->head; toIndex--; p = &Policy::next(*p)) ;
+    p = this->linkAt(toIndex, previous);
+
+    this->link(p, previous, newNode);
 
-    Policy::next(newNode) = *p;
-    *p = newNode;
-    ++this->length;
-    
     if constexpr (!Policy::isIntrusive) return 0;
 }
 
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && Retainable<Element>
+template<typename Compare>
+void RetainedList<Element, Policy>::merge(RetainedList &source, Compare compare) noexcept {
+    this->mergeNodes(source, compare);
+}
+
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element> && Retainable<Element>
 void RetainedList<Element, Policy>::remove(const Element *e) noexcept {
-    if (!e) return;
-
-    NodePtr *p, q;
-
-    for (p = &this->head; *p; p = &Policy::next(*p)) {
-        if (Policy::extract(*p) == e) {
-            q = *p;
-            *p = Policy::next(*p);
-            Policy::destroy(q);
-            --this->length;
-            return;
-        }
-    }
+    NodePtr previous, *p = this->locate(e, previous);
+
+    if (p == nullptr) return;
+
+    NodePtr q = this->unlink(p, previous);
+
+    Policy::destroy(q);
 }
 
 template<typename Element, typename Policy>
 requires ListNodePolicy<Policy, Element> && Retainable<Element>
 void RetainedList<Element, Policy>::splice(size_t fromIndex, size_t toIndex) noexcept {
     if (fromIndex >= this->length || toIndex > this->length || fromIndex == toIndex) return;
-    
-    size_t i;
-    NodePtr *from = nullptr, *p, q, *to = nullptr;
-
-    for (i = 0, p = &this->head; *p; ++i, p = &Policy::next(*p)) {
-        if (i == fromIndex) from = p;
-        if (i == toIndex) to = p;
-
-        if (from && to) {
-            q = *from;
-            *from = Policy::next(q);
-            Policy::next(q) = *to;
-            *to = q;
-            break;
-        }
-    }
+
+    NodePtr previous, *p = this->linkAt(fromIndex, previous);
+    NodePtr q = this->unlink(p, previous);
+
+    // toIndex names the position before the move, one less once q is out from ahead of it
+    if (fromIndex < toIndex) --toIndex;
+
+    p = this->linkAt(toIndex, previous);
+    this->link(p, previous, q);
 }
 
 template<typename Element, typename Policy>
@@ -184,15 +207,44 @@ requires ListNodePolicy<Policy, Element> && Retainable<Element>
 void RetainedList<Element, Policy>::splice(RetainedList &source, Element *e, size_t toIndex) noexcept {
     if (!e || toIndex > this->length) return;
 
-    // Adjust toIndex if moving to the end of the same list
-    if (&source == this && this->length && toIndex == this->length) --toIndex;
+    NodePtr previous, *p = source.locate(e, previous);
+
+    if (p == nullptr) return;
 
-    e->retain();
+    // the node moves as is, nothing is destroyed, retained or released
+    NodePtr q = source.unlink(p, previous);
 
-    source.remove(e);
-    insert(e, toIndex);
+    if (toIndex > this->length) toIndex = this->length;
+
+    p = this->linkAt(toIndex, previous);
+    this->link(p, previous, q);
+}
 
-    e->release();
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && Retainable<Element>
+template<typename Compare>
+auto RetainedList<Element, Policy>::sortedInsert(Element *e, Compare compare) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t> {
+    return sortedInsert(Ref<Element>(e), compare);
+}
+
+template<typename Element, typename Policy>
+requires ListNodePolicy<Policy, Element> && Retainable<Element>
+template<typename Compare>
+auto RetainedList<Element, Policy>::sortedInsert(Ref<Element> &&e, Compare compare) noexcept -> std::conditional_t<Policy::isIntrusive, void, err_t> {
+    if (!e) {
+        if constexpr (!Policy::isIntrusive) return 0;
+        else return;
+    }
+
+    NodePtr newNode = adopt(e);
+
+    if constexpr (!Policy::isIntrusive) {
+        if (!newNode) return ENOMEM;
+    }
+
+    this->linkSorted(newNode, compare);
+
+    if constexpr (!Policy::isIntrusive) return 0;
 }
 
 // MARK: - Aliases
@@ -200,6 +252,9 @@ void RetainedList<Element, Policy>::splice(RetainedList &source, Element *e, siz
 template<typename Element>
 using IntrusiveRetainedPolicy = RetainedPolicy<Element, IntrusivePolicy<Element>>;
 
+template<typename Element>
+using IntrusiveDoublyLinkedRetainedPolicy = RetainedPolicy<Element, IntrusiveDoublyLinkedPolicy<Element>>;
+
 template<typename Element>
 using NonIntrusiveRetainedPolicy = RetainedPolicy<Element, NonIntrusivePolicy<Element>>;
 
@@ -212,7 +267,8 @@ using NonIntrusiveRetainedPolicy = RetainedPolicy<Element, NonIntrusivePolicy<El
  * - **Intrusive**: Element must derive from `ListElement<Element>` (provides
  *   a `next` pointer), and thus may only belong to one intrusive list at a time.  
  * - **Reference-counted**: on `append()`/`insert()`, calls `e->retain()`; on
- *   `remove()`/`clear()`, calls `e->release()` (via `RetainedPolicy`)
+ *   `remove()`/`clear()`, calls `e->release()` (via `RetainedPolicy`). Passing a
+ *   `Ref<Element>` by std::move hands its reference to the list without a retain.
  * - **Non-owning**: the list never calls `delete e;`, only adjusts its refcount,
  *   however as with any reference-counted object any operation such as remove()
  *   that decrements the retain count to zero will result in immediate deletion
@@ -275,6 +331,15 @@ using NonIntrusiveRetainedPolicy = RetainedPolicy<Element, NonIntrusivePolicy<El
 template<typename Element>
 using IntrusiveRetainedList = RetainedList<Element, IntrusiveRetainedPolicy<Element>>;
 
+/**
+ * @brief IntrusiveDoublyLinkedRetainedList<Element> — IntrusiveRetainedList with O(1) remove()
+ *
+ * As IntrusiveRetainedList, but Element must derive from DoublyLinkedListElement<Element>.
+ * remove(e) requires that e is in this list or in no list at all.
+ */
+template<typename Element>
+using IntrusiveDoublyLinkedRetainedList = RetainedList<Element, IntrusiveDoublyLinkedRetainedPolicy<Element>>;
+
 /**
  * @brief NonIntrusiveRetainedList<Element> — a non-intrusive, reference-counted list
  *
@@ -0,0 +1,90 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "err_t.h"
+
+// SPSCRing is a fixed capacity, lock-free ring buffer for exactly one producer and one
+// consumer, e.g. an ISR and the task that handles its events. Neither side blocks and
+// push() is safe from an ISR.
+//
+// head and tail run freely and are masked on access, so the ring holds a full capacity
+// of items. push() on a full ring drops the new item and counts it, leaving what the
+// consumer hasn't read yet intact.
+template<typename T>
+class SPSCRing {
+
+public:
+
+    SPSCRing() = default;
+    SPSCRing(SPSCRing const &) = delete;
+   ~SPSCRing() { delete[] buffer; }
+
+    void                        operator=(SPSCRing const &) = delete;
+
+    size_t                      getCapacity() const { return buffer ? mask + 1 : 0; }
+    uint32_t                    getDropped() const { return __atomic_load_n(&dropped, __ATOMIC_RELAXED); }
+    // capacity is rounded up to a power of two
+    err_t                       init(size_t capacity) {
+        size_t rounded = 1;
+
+        if (buffer) return EALREADY;
+        if (capacity == 0 || capacity > 0x80000000) return EINVAL;
+
+        while (rounded < capacity) rounded <<= 1;
+
+        if ((buffer = new T[rounded]) == nullptr) return ENOMEM;
+
+        mask = uint32_t(rounded - 1);
+
+        return 0;
+    }
+
+    // consumer side
+    bool                        pop(T &item) { return pop(&item, 1) == 1; }
+    // pop() moves up to maxCount items into items and returns the number moved
+    size_t                      pop(T *items, size_t maxCount) {
+        uint32_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        uint32_t available = __atomic_load_n(&head, __ATOMIC_ACQUIRE) - t;
+        size_t count = available < maxCount ? available : maxCount;
+
+        for (size_t i = 0; i < count; ++i) items[i] = buffer[(t + i) & mask];
+
+        __atomic_store_n(&tail, t + uint32_t(count), __ATOMIC_RELEASE);
+
+        return count;
+    }
+    size_t                      size() const { return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE); }
+
+    // producer side
+    bool                        push(const T &item) {
+        uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+        if (buffer == nullptr || h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) > mask) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        buffer[h & mask] = item;
+
+        __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+
+        return true;
+    }
+
+private:
+
+    T *                         buffer = nullptr;
+    uint32_t                    dropped = 0;
+    uint32_t                    head = 0;               // next slot written, owned by the producer
+    uint32_t                    mask = 0;
+    uint32_t                    tail = 0;               // next slot read, owned by the consumer
+
+};
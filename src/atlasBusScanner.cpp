@@ -0,0 +1,308 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#include "atlasBusScanner.h"
+#include "atlasEC.h"
+#include "atlasPH.h"
+#include "atlasRTD.h"
+
+// response byte (1) + largest string (40) + terminator (1: '\0')
+#define EZO_BUFFER_SIZE         42
+// the EZO "i" command takes 300ms to process
+#define EZO_INFO_WAIT_MS        300
+#define EZO_BUSY_RETRY_MS       100
+#define EZO_BUSY_RETRIES        3
+
+// The scan task uses a semaphore for its runloop notifications so the task notification
+// is left free for the synchronous sends AtlasSensor::init() performs on it. Without this
+// a rescan timer firing mid-init would wake the synchronous send early.
+class AtlasBusScanner::ScanTask : public DispatchTask {
+
+public:
+
+    ScanTask() : DispatchTask(false) { }
+
+    err_t init(const char *taskName) {
+        if (getTaskSemaphore() == nullptr) return ENOMEM;
+
+        return DispatchTask::init(taskName);
+    }
+
+};
+
+// --- AtlasBusScanner ---
+
+AtlasBusScanner::AtlasBusScanner() { }
+
+AtlasBusScanner::~AtlasBusScanner() {
+    if (timer) {
+        timer->stop();
+        timer->release();
+    }
+    if (scanTask) {
+        scanTask->stopTask(true);
+        delete scanTask;
+    }
+    for (uint8_t address = firstAddress; address <= lastAddress; ++address) {
+        _release(entries[address].sensor);
+    }
+}
+
+void AtlasBusScanner::attach(uint8_t address, SensorType type) {
+    err_t err = 0;
+    const char *name;
+    AtlasSensor *sensor;
+
+    switch (type) {
+        case SensorType::ec:    name = "EC";    break;
+        case SensorType::ph:    name = "pH";    break;
+        case SensorType::rtd:   name = "RTD";   break;
+        default:                return;
+    }
+
+    if ((sensor = makeSensor(type)) == nullptr) setErr(ENOMEM);
+    if (!err) {
+        sensor->setI2CPort(portNumber);
+        err = sensor->init(name, address, sensorTask);
+    }
+    if (!err) {
+        lock.lock();
+        entries[address].sensor = sensor;
+        entries[address].type = type;
+        entries[address].missedProbes = 0;
+        lock.unlock();
+
+        logi("%s sensor attached at 0x%x", name, address);
+
+        notifyObservers(makeRef<SensorMessage>(MessageTag::attached, sensor, address));
+    } else {
+        loge("error %d attaching %s sensor at 0x%x", err, name, address);
+        _release(sensor);
+    }
+}
+
+void AtlasBusScanner::detach(uint8_t address) {
+    lock.lock();
+
+    Entry entry = entries[address];
+
+    entries[address] = Entry();
+
+    lock.unlock();
+
+    if (entry.sensor == nullptr) return;
+
+    logw("%s sensor at 0x%x stopped responding, detaching", entry.sensor->getName(), address);
+
+    entry.sensor->stop();
+
+    // repoint any sensor compensating against a departing RTD before it goes away
+    if (entry.type == SensorType::rtd) {
+        AtlasRTD *replacement = findTemperatureProvider();
+
+        for (uint8_t i = firstAddress; i <= lastAddress; ++i) {
+            if (entries[i].type != SensorType::ec && entries[i].type != SensorType::ph) continue;
+
+            AtlasTemperatureCompensatedSensor *tcSensor = static_cast<AtlasTemperatureCompensatedSensor *>(entries[i].sensor);
+
+            if (tcSensor->getTemperatureProvider() == static_cast<AtlasRTD *>(entry.sensor)) {
+                tcSensor->setTemperatureProvider(replacement);
+            }
+        }
+    }
+
+    notifyObservers(makeRef<SensorMessage>(MessageTag::detached, entry.sensor, address));
+
+    entry.sensor->release();
+}
+
+void AtlasBusScanner::eventHandler(void *context, DispatchEventSource *source) {
+    ((AtlasBusScanner *) context)->handleEvent(source);
+}
+
+AtlasRTD *AtlasBusScanner::findTemperatureProvider() {
+    for (uint8_t address = firstAddress; address <= lastAddress; ++address) {
+        if (entries[address].type == SensorType::rtd) return static_cast<AtlasRTD *>(entries[address].sensor);
+    }
+
+    return nullptr;
+}
+
+AtlasSensor *AtlasBusScanner::getSensor(uint8_t address) {
+    if (address < firstAddress || address > lastAddress) return nullptr;
+
+    lock.lock();
+
+    AtlasSensor *sensor = entries[address].sensor;
+
+    lock.unlock();
+
+    return sensor;
+}
+
+void AtlasBusScanner::handleEvent(DispatchEventSource *source) {
+    I2C::DeviceHandle devices[lastAddress + 1] = {};
+    SensorType types[lastAddress + 1] = {};
+    uint8_t address;
+    size_t respondersCount = 0;
+
+    // probe every address and kick off an "i" command on each new responder so
+    // the EZO processing time overlaps across all of them.
+    for (address = firstAddress; address <= lastAddress; ++address) {
+        bool isBound = entries[address].sensor != nullptr;
+
+        // leave devices we don't own alone (e.g. sensors created via shared())
+        if (!isBound && i2c->isDeviceRegistered(address)) continue;
+
+        bool isPresent = i2c->probe(address) == 0;
+
+        if (isBound) {
+            if (isPresent) {
+                entries[address].missedProbes = 0;
+            } else if (++entries[address].missedProbes >= missedProbesBeforeDetach) {
+                detach(address);
+            }
+        } else if (isPresent) {
+            err_t err = i2c->registerDevice(address, devices[address]);
+
+            if (!err && (err = i2c->write(devices[address], "i"))) {
+                i2c->unregisterDevice(devices[address]);
+                devices[address] = nullptr;
+            }
+            if (!err) ++respondersCount;
+        }
+    }
+
+    if (respondersCount) {
+        delay(EZO_INFO_WAIT_MS);
+
+        for (address = firstAddress; address <= lastAddress; ++address) {
+            if (devices[address] == nullptr) continue;
+
+            if (readInfo(devices[address], types[address])) types[address] = SensorType::unknown;
+
+            // the sensor registers its own device handle in init()
+            i2c->unregisterDevice(devices[address]);
+        }
+
+        // attach temperature providers first so compensated sensors can find one
+        for (address = firstAddress; address <= lastAddress; ++address) {
+            if (types[address] == SensorType::rtd) attach(address, types[address]);
+        }
+        for (address = firstAddress; address <= lastAddress; ++address) {
+            if (types[address] == SensorType::ec || types[address] == SensorType::ph) attach(address, types[address]);
+        }
+    }
+
+    // give compensated sensors discovered before any RTD a provider now that one may exist
+    AtlasRTD *provider = findTemperatureProvider();
+
+    for (address = firstAddress; provider && address <= lastAddress; ++address) {
+        if (entries[address].type != SensorType::ec && entries[address].type != SensorType::ph) continue;
+
+        AtlasTemperatureCompensatedSensor *tcSensor = static_cast<AtlasTemperatureCompensatedSensor *>(entries[address].sensor);
+
+        if (tcSensor->getTemperatureProvider() == nullptr) tcSensor->setTemperatureProvider(provider);
+    }
+}
+
+err_t AtlasBusScanner::init(DispatchTask *sensorTask, uint32_t rescanIntervalMs, i2c_port_num_t portNumber) {
+    if (timer) return EALREADY;
+
+    err_t err = 0;
+
+    this->i2c = &I2C::shared(portNumber);
+    this->portNumber = portNumber;
+    this->rescanIntervalMs = rescanIntervalMs;
+    this->sensorTask = sensorTask;
+
+    if ((scanTask = new ScanTask()) == nullptr) setErr(ENOMEM);
+    if (!err) err = scanTask->init("AtlasBusScanner");
+    if (!err && (timer = new DispatchTimerSource()) == nullptr) setErr(ENOMEM);
+    if (!err) err = timer->init(eventHandler, this, "AtlasBusScanner", scanTask);
+    if (!err && rescanIntervalMs) err = timer->startPeriodic(uint64_t(rescanIntervalMs) * 1000, 1000 * 1000);
+    if (!err) scan();
+
+    if (err) {
+        _release(timer);
+        if (scanTask) {
+            if (scanTask->isTaskActive()) scanTask->stopTask(true);
+            _delete(scanTask);
+        }
+    }
+
+    return err;
+}
+
+AtlasSensor *AtlasBusScanner::makeSensor(SensorType type) {
+    switch (type) {
+        case SensorType::ec:    return new AtlasEC(findTemperatureProvider());
+        case SensorType::ph:    return new AtlasPH(findTemperatureProvider());
+        case SensorType::rtd:   return new AtlasRTD();
+        default:                return nullptr;
+    }
+}
+
+err_t AtlasBusScanner::readInfo(I2C::DeviceHandle device, SensorType &type) {
+    uint8_t buffer[EZO_BUFFER_SIZE];
+    err_t err;
+    AtlasSensor::InfoResponse response;
+
+    for (int i = 0;; ++i) {
+        memset(buffer, 0, sizeof(buffer));
+
+        if ((err = i2c->read(device, buffer, sizeof(buffer) - 1))) break;
+        if (buffer[0] != 254 || i == EZO_BUSY_RETRIES) break;
+
+        delay(EZO_BUSY_RETRY_MS);
+    }
+    if (!err && buffer[0] != 1) err = buffer[0] == 254 ? EBUSY : EBADMSG;
+    if (!err) {
+        response.responsePrefix = "?i,";
+        err = response.parse((char *) buffer + 1);
+    }
+    if (!err) {
+        type = sensorTypeFromString(response.sensorType);
+
+        if (type == SensorType::unknown) {
+            logw("unsupported EZO device type '%s' at 0x%x", response.sensorType, device->address);
+        }
+    }
+
+    return err;
+}
+
+void AtlasBusScanner::scan() {
+    if (timer) timer->dispatchEvent();
+}
+
+AtlasBusScanner::SensorType AtlasBusScanner::sensorTypeFromString(const char *sensorType) {
+    if (sensorType == nullptr) return SensorType::unknown;
+    if (!strcasecmp(sensorType, "EC")) return SensorType::ec;
+    if (!strcasecmp(sensorType, "pH")) return SensorType::ph;
+    if (!strcasecmp(sensorType, "RTD")) return SensorType::rtd;
+
+    return SensorType::unknown;
+}
+
+AtlasBusScanner &AtlasBusScanner::shared() {
+    static AtlasBusScanner *singleton = new AtlasBusScanner();
+
+    return *singleton;
+}
+
+// --- AtlasBusScanner::SensorMessage ---
+
+AtlasBusScanner::SensorMessage::SensorMessage(MessageTag tag, AtlasSensor *sensor, uint8_t address) :
+    Message(uint32_t(tag)),
+    sensor(sensor),
+    address(address)
+{
+    sensor->retain();
+}
+
+AtlasBusScanner::SensorMessage::~SensorMessage() {
+    sensor->release();
+}
@@ -16,6 +16,10 @@ AtlasEC::AtlasEC()
     // isLogSentCommandsEnabled = true;
 }
 
+AtlasEC::AtlasEC(TemperatureProvider *temperatureProvider)
+    : AtlasTemperatureCompensatedSensor(temperatureProvider)
+{ }
+
 double AtlasEC::convertReadingResponseToDouble(char *response) {
     if (!(response && *response)) return DBL_MIN;
     if (!strcasecmp(response, "no output")) return DBL_MIN;
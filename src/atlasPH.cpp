@@ -17,6 +17,10 @@ AtlasPH::AtlasPH() :
     // isLogSentCommandsEnabled = true;
 }
 
+AtlasPH::AtlasPH(TemperatureProvider *temperatureProvider) :
+    AtlasTemperatureCompensatedSensor(temperatureProvider)
+{ }
+
 #if ENABLE_ATLAS_SIMULATOR
 err_t AtlasPH::getSimulatedReading(char *buffer, size_t bufferSize) {
     double pH = simulatedPH;
@@ -7,25 +7,32 @@
 
 // response byte (1) + largest string (40) + terminator (1: '\0')
 #define EZO_BUFFER_SIZE     42
+// EZO processing times are minimums, reading the response up to 10% late lets the wait share a wake-up
+#define EZO_WAIT_SLACK_US(ms)   (uint32_t(ms) * 100)
 
 // --- AtlasSensor ---
 
-I2C &AtlasSensor::i2c = I2C::shared(I2C_NUM_0);
-
 AtlasSensor::ReadingMessage::ReadingMessage(double value, UnixTime when) :
     Message(uint32_t(MessageTag::read), when),
     value(value)
 { }
 
-AtlasSensor::AtlasSensor() {
+AtlasSensor::AtlasSensor() :
+    i2c(&I2C::shared(I2C_NUM_0))
+{
     // isDumpResponseBufferEnabled = true;
     // isLogSentCommandsEnabled = true;
 }
 
 AtlasSensor::~AtlasSensor() {
-    if (i2cDevice) i2c.unregisterDevice(i2cDevice);
+    // the bus worker references transaction and timer until it has dispatched the completion
+    i2c->cancel(&transaction);
+
+    if (i2cDevice) i2c->unregisterDevice(i2cDevice);
     if (timer) {
         timer->stop();
+        // a completion or expiry already queued must not reach handleEvent() now
+        timer->removeFromDispatchTask();
         timer->release();
     }
 }
@@ -106,9 +113,20 @@ err_t AtlasSensor::getSimulatedReading(char *buffer, size_t bufferSize) { return
 void AtlasSensor::handleEvent(DispatchEventSource *source) {
     lock();
     Command *command = pendingCommand;
+    bool isResend = !command && isSendDeferred;
+    bool isSending = ioState == IOState::sending;
+    if (isResend) isSendDeferred = false;
     unlock();
 
-    if (!command) return;
+    // With no pending command this is either the send deferred while the device's breaker
+    // was open, or a stray event (a late timer or completion) that there's nothing to do for.
+    if (!command) {
+        if (isResend) send(false);
+        return;
+    }
+
+    // a stray event while send() still has the command, send() dispatches when it's done
+    if (isSending) return;
 
     // _logi("in handleEvent, command is %s", command->commandString);
 
@@ -116,21 +134,18 @@ void AtlasSensor::handleEvent(DispatchEventSource *source) {
     Response *response = command->response;
     err_t err = response->err;
 
+    // EINPROGRESS means the command is waiting on the bus or the EZO device
+    // and this handler will be called again when it's time for the next step.
+    if (!err && (err = processIO(command, buffer, sizeof(buffer))) == EINPROGRESS) return;
     if (!err && command->responseWaitMs) {
-        // If readResponse returns busy we haven't waited long enough for
-        // the command completion. In this case, try again in 100ms.
-        if ((err = readResponse(command, buffer, sizeof(buffer))) == EBUSY) {
-            timer->startOnce(100 * 1000);
-            return;
-        }
-        if (!err) {
-            _logv("%s command '%s' response '%s'", getName(), command->commandString, buffer);
-            err = command->response->parse(buffer);
-        }
+        _logv("%s command '%s' response '%s'", getName(), command->commandString, buffer);
+        err = command->response->parse(buffer);
     }
 
     if (err) {
-        _loge("%s sensor command '%s' failed with error %d %lld", getName(), command->commandString, err, esp_timer_get_time());
+        if (err != ECONNREFUSED) {
+            _loge("%s sensor command '%s' failed with error %d %lld", getName(), command->commandString, err, esp_timer_get_time());
+        }
 
         response->err = err;
 
@@ -172,6 +187,24 @@ void AtlasSensor::handleEvent(DispatchEventSource *source) {
 
             command->prepareForReuse();
             enqueueCommand(command);
+
+            // Don't spin on a device whose breaker is open. Come back when it will
+            // admit a trial transaction and let the other sensors on this task run.
+            // A stopped sensor isn't deferred, the send below fails the queue with EINTR.
+            if (err == ECONNREFUSED) {
+                uint32_t retryDelayMs = i2c->getRetryDelayMs(i2cDevice);
+
+                // started under the lock so a send() clearing the deferral stops it after this
+                lock();
+                bool isDeferred = !isStopped;
+                if (isDeferred) {
+                    isSendDeferred = true;
+                    timer->startOnce(uint64_t(retryDelayMs ? retryDelayMs : 1) * 1000, 50 * 1000);
+                }
+                unlock();
+
+                if (isDeferred) return;
+            }
         } break;
 
         case CompletionBehavior::resend: {
@@ -186,7 +219,7 @@ void AtlasSensor::handleEvent(DispatchEventSource *source) {
 
 void AtlasSensor::handleReading(Response &response) {
     err_t err = 0;
-    ReadingMessage *message = nullptr;
+    Ref<Message> message;
     double value = convertReadingResponseToDouble(response.responseString);
 
     // if the value is garbage don't report it
@@ -203,8 +236,11 @@ void AtlasSensor::handleReading(Response &response) {
 
     unlock();
 
-    if ((message = new ReadingMessage(value, when)) == nullptr) setErr(ENOMEM);
-    if (!err) notifyObservers(message);
+    // don't build a message nobody will see
+    if (!isObserved()) return;
+
+    if (!(message = makeRef<ReadingMessage>(value, when))) setErr(ENOMEM);
+    if (!err) notifyObservers(std::move(message));
 }
 
 err_t AtlasSensor::init(const char *name, uint8_t i2cSlaveAddress, DispatchTask *task) {
@@ -214,7 +250,7 @@ err_t AtlasSensor::init(const char *name, uint8_t i2cSlaveAddress, DispatchTask
 err_t AtlasSensor::init(const char *name, uint8_t i2cSlaveAddress, DispatchTask *task, bool deferEnqueueSendGetReading) {
     err_t err = setName(name);
 
-    if (!err) err = i2c.registerDevice(i2cSlaveAddress, i2cDevice);
+    if (!err) err = i2c->registerDevice(i2cSlaveAddress, i2cDevice);
 
 #if ENABLE_ATLAS_SIMULATOR
     if (!err) {
@@ -248,66 +284,48 @@ bool AtlasSensor::isForcedValueEnabled(double *forcedValue) {
     return isEnabled;
 }
 
-err_t AtlasSensor::readResponse(Command *command, char *responseBuffer, size_t responseBufferSize) {
-    // _logi("in readResponse, command is %s", command->commandString);
+err_t AtlasSensor::parseResponseBuffer(const uint8_t *buffer, size_t bufferSize, char *responseBuffer, size_t responseBufferSize) {
+    err_t err = 0;
 
-    uint8_t buffer[EZO_BUFFER_SIZE] = {0};
-    err_t err;
+    if (responseBuffer == nullptr || responseBufferSize < bufferSize) return EINVAL;
 
-    if (responseBuffer == nullptr || responseBufferSize < sizeof(buffer)) return EINVAL;
+    // we're expecting a response byte here
+    switch (buffer[0]) {
+        case 1: {
+            _logv("%s sensor returned successful request", getName());
+        } break;
 
-#if !ENABLE_ATLAS_SIMULATOR
-    // _logi("calling i2c.read(), buffer size is %d", sizeof(buffer));
-    err = i2c.read(i2cDevice, buffer, sizeof(buffer));
-#else
-    if (!isSimulatorEnabled) {
-        err = i2c.read(i2cDevice, buffer, sizeof(buffer));
-    } else if (command->responseSimulator) {
-        err = command->responseSimulator(this, buffer, sizeof(buffer));
-    } else {
-        buffer[0] = 1;
-        buffer[1] = 0;
-        err = 0;
-    }
-#endif
-    if (!err) {
-        // we're expecting a response byte here
-        switch (buffer[0]) {
-            case 1: {
-                _logv("%s sensor returned successful request", getName());
-            } break;
-
-            case 2: {
-                _loge("%s sensor returned syntax error", getName());
-                err = EINVAL;
-            } break;
-
-            case 254: {
-                _logw("%s sensor returned still processing, not ready", getName());
-                err = EBUSY;
-            } break;
-
-            case 255: {
-                // I think "no data to send" happens if there is no active command.
-                // This shouldn't be able to happen given the design of this class.
-                // If it does it's an error and there's nothing to do but
-                // return a command failure.
-                _loge("%s sensor returned no data to send", getName());
-                err = ENODATA;
-            } break;
-
-            default: {
-                _loge("%s sensor returned unexpected response byte %d, aborting", getName(), buffer[0]);
-                err = EBADMSG;
-            } break;
-        }
+        case 2: {
+            _loge("%s sensor returned syntax error", getName());
+            err = EINVAL;
+        } break;
+
+        case 254: {
+            _logw("%s sensor returned still processing, not ready", getName());
+            err = EBUSY;
+        } break;
+
+        case 255: {
+            // I think "no data to send" happens if there is no active command.
+            // This shouldn't be able to happen given the design of this class.
+            // If it does it's an error and there's nothing to do but
+            // return a command failure.
+            _loge("%s sensor returned no data to send", getName());
+            err = ENODATA;
+        } break;
 
-        if (err || isDumpResponseBufferEnabled) dump(buffer, sizeof(buffer));
+        default: {
+            _loge("%s sensor returned unexpected response byte %d, aborting", getName(), buffer[0]);
+            err = EBADMSG;
+        } break;
     }
+
+    if (err || isDumpResponseBufferEnabled) dump(buffer, bufferSize);
+
     if (!err) {
         // copy data out of the buffer to the response string
         int i = 0;
-        int n = sizeof(buffer) - 1;
+        int n = bufferSize - 1;
 
         while (++i < n && (*responseBuffer++ = char(buffer[i]))) ;
 
@@ -317,9 +335,67 @@ err_t AtlasSensor::readResponse(Command *command, char *responseBuffer, size_t r
     return err;
 }
 
+err_t AtlasSensor::processIO(Command *command, char *responseBuffer, size_t responseBufferSize) {
+    err_t err = 0;
+
+    switch (ioState) {
+        case IOState::sending: {
+            // handleEvent() drops events while send() has the command, nothing to do yet
+            err = EINPROGRESS;
+        } break;
+
+        case IOState::idle: {
+            // send() finished the command inline: it failed, is simulated or expects no response
+#if ENABLE_ATLAS_SIMULATOR
+            // the simulator completes inline, there is no bus transaction to wait for
+            if (command->responseWaitMs) err = simulateResponse(command, responseBuffer, responseBufferSize);
+#endif
+        } break;
+
+        case IOState::writing: {
+            // some other event on the timer source, the write hasn't finished
+            if (transaction.isPending.load(MemoryOrder::acquire)) return EINPROGRESS;
+
+            ioState = IOState::idle;
+
+            if ((err = transaction.err)) break;
+            if (command->responseWaitMs) {
+                ioState = IOState::waitingForResponse;
+                if (!(err = timer->startOnce(command->responseWaitMs * 1000, EZO_WAIT_SLACK_US(command->responseWaitMs)))) err = EINPROGRESS;
+            }
+        } break;
+
+        case IOState::waitingForResponse: {
+            memset(ioBuffer, 0, sizeof(ioBuffer));
+
+            if (!(err = submitTransaction(I2C::Transaction::Operation::read, ioBuffer, sizeof(ioBuffer)))) err = EINPROGRESS;
+        } break;
+
+        case IOState::reading: {
+            if (transaction.isPending.load(MemoryOrder::acquire)) return EINPROGRESS;
+
+            ioState = IOState::idle;
+
+            if (!(err = transaction.err)) err = parseResponseBuffer(ioBuffer, sizeof(ioBuffer), responseBuffer, responseBufferSize);
+
+            // If the device is busy we haven't waited long enough for
+            // the command completion. In this case, try again in 100ms.
+            if (err == EBUSY) {
+                ioState = IOState::waitingForResponse;
+                if (!(err = timer->startOnce(100 * 1000, 20 * 1000))) err = EINPROGRESS;
+            }
+        } break;
+    }
+
+    if (err && err != EINPROGRESS) ioState = IOState::idle;
+
+    return err;
+}
+
 err_t AtlasSensor::send(bool synchronous) {
     Command *command;
     err_t err = 0;
+    bool isSubmitted = false;
 
     lock();
 
@@ -331,6 +407,12 @@ err_t AtlasSensor::send(bool synchronous) {
             commands = command->next;
             command->next = nullptr;
             pendingCommand = command;
+
+            // whatever was deferred is being sent now, its retry timer would only be a stray event
+            if (isSendDeferred) {
+                isSendDeferred = false;
+                timer->stop();
+            }
         }
     }
 
@@ -339,6 +421,8 @@ err_t AtlasSensor::send(bool synchronous) {
         err = EINTR;
     }
     if (!err) command->hasSent = true;
+    // published with pendingCommand, an event arriving before send() is done with it waits
+    if (err != EBUSY && err != ENOENT) ioState = IOState::sending;
 
     unlock();
 
@@ -360,32 +444,47 @@ err_t AtlasSensor::send(bool synchronous) {
         command->taskToWake = xTaskGetCurrentTaskHandle();
     }
     if (!err) {
-        if (isLogSentCommandsEnabled) _logi("%s -> %s", getName(), command->commandString);
-#if !ENABLE_ATLAS_SIMULATOR
-        err = i2c.write(i2cDevice, command->commandString);
-#else
-        if (!isSimulatorEnabled) err = i2c.write(i2cDevice, command->commandString);
+        bool isSimulated = false;
+
+#if ENABLE_ATLAS_SIMULATOR
+        isSimulated = isSimulatorEnabled;
 #endif
-    }
-    if (!err) {
-        _logv("wrote '%s' to I2C slave @ 0x%x)", command->commandString, i2cDevice->address);
-        
-        if (command->responseWaitMs) {
-            err = timer->startOnce(command->responseWaitMs * 1000);
-        } else {
-            fireTimerImmediately = true;
+        if (isLogSentCommandsEnabled) _logi("%s -> %s", getName(), command->commandString);
+
+        if (!isSimulated) {
+            // The write completes through the timer's event handler, see processIO(). Once
+            // it's submitted the handler owns the command, so send() no longer touches it.
+            lock();
+            if (!(err = submitTransaction(I2C::Transaction::Operation::write, (uint8_t *) command->commandString, strlen(command->commandString)))) isSubmitted = true;
+            unlock();
         }
     }
 
-    if (err) command->response->err = err;
-    if (err || fireTimerImmediately) {
+    // Not handed to the bus, the command is finished as far as send() goes. Once ioState is
+    // idle an event may complete it, so send() is done with it before the lock is released.
+    if (!isSubmitted) {
+        lock();
+
+#if ENABLE_ATLAS_SIMULATOR
+        if (!err && isSimulatorEnabled) {
+            if (command->responseWaitMs) {
+                err = timer->startOnce(command->responseWaitMs * 1000, EZO_WAIT_SLACK_US(command->responseWaitMs));
+            } else {
+                fireTimerImmediately = true;
+            }
+        }
+#endif
+        if (err) command->response->err = err;
+
+        ioState = IOState::idle;
+
+        unlock();
+
         // here we don't expect to receive a response from the ezo device.
         // this is either because of an error or because the command doesn't
         // support it. either way we consider the command finished and
         // need to trigger the timer so resources can be cleaned up.
-
-        // if there's an error and we aren't 
-        timer->dispatchEvent();
+        if (err || fireTimerImmediately) timer->dispatchEvent();
     }
 
     if (synchronous) while (!ulTaskNotifyTake(pdTRUE, portMAX_DELAY));
@@ -679,6 +778,24 @@ err_t AtlasSensor::sendSleep(bool synchronous, void *context, CommandCallback ca
     return makeAndSendCommand<Response>(synchronous, "sleep", context, callback, nullptr, 0);
 }
 
+#if ENABLE_ATLAS_SIMULATOR
+err_t AtlasSensor::simulateResponse(Command *command, char *responseBuffer, size_t responseBufferSize) {
+    uint8_t buffer[EZO_BUFFER_SIZE] = {0};
+    err_t err = 0;
+
+    if (command->responseSimulator) {
+        err = command->responseSimulator(this, buffer, sizeof(buffer));
+    } else {
+        buffer[0] = 1;
+        buffer[1] = 0;
+    }
+
+    if (!err) err = parseResponseBuffer(buffer, sizeof(buffer), responseBuffer, responseBufferSize);
+
+    return err;
+}
+#endif
+
 void AtlasSensor::setForcedValue(bool isEnabled, double forcedValue) {
     lock();
 
@@ -688,11 +805,26 @@ void AtlasSensor::setForcedValue(bool isEnabled, double forcedValue) {
     unlock();
 }
 
+void AtlasSensor::setI2CPort(i2c_port_num_t portNumber) {
+    if (i2cDevice == nullptr) i2c = &I2C::shared(portNumber);
+}
+
 void AtlasSensor::stop() {
     lock();
     isStopped = true;
+
+    // a send deferred behind an open breaker would hold the queue for the whole backoff
+    if (isSendDeferred) {
+        isSendDeferred = false;
+        timer->stop();
+    }
+
     unlock();
 
+    // Fail what's queued with EINTR now, each completion sends the next. Only a command
+    // already on the bus is waited for, and with the breaker open that fails fast.
+    send(false);
+
     for (bool done = false;;) {
         lock();
 
@@ -702,12 +834,29 @@ void AtlasSensor::stop() {
 
         if (done) break;
 
-        delay(1000);
+        delay(100);
     }
 
     timer->stop();
 }
 
+err_t AtlasSensor::submitTransaction(I2C::Transaction::Operation operation, uint8_t *buffer, size_t length) {
+    transaction.buffer = buffer;
+    transaction.completionSource = timer;
+    transaction.device = i2cDevice;
+    transaction.length = length;
+    transaction.operation = operation;
+
+    // set before submitting, the completion can be handled before submit() returns
+    ioState = operation == I2C::Transaction::Operation::write ? IOState::writing : IOState::reading;
+
+    err_t err = i2c->submit(&transaction);
+
+    if (err) ioState = IOState::idle;
+
+    return err;
+}
+
 // --- AtlasSensor::BoolResponse ---
 
 err_t AtlasSensor::BoolResponse::parse(char *response) {
@@ -786,7 +935,7 @@ err_t AtlasSensor::InfoResponse::parse(char *response) {
     if (!err && !(sensorType = field())) err = EBADMSG;
     if (!err && !(firmwareVersion = field())) err = EBADMSG;
 
-    sscanf(firmwareVersion, "%d.%d", &firmwareMajorVersion, &firmwareMinorVersion);
+    if (!err) sscanf(firmwareVersion, "%d.%d", &firmwareMajorVersion, &firmwareMinorVersion);
 
     return err;
 }
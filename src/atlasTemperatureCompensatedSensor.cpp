@@ -13,10 +13,30 @@ double AtlasTemperatureCompensatedSensor::getCurrentTemperature() {
     if (isForcedTemperature) {
         return forcedDegreesC;
     } else {
-        return temperatureProvider ? temperatureProvider->getCurrentTemperature() : DBL_MIN;
+        return getProviderTemperature();
     }
 }
 
+double AtlasTemperatureCompensatedSensor::getProviderTemperature() {
+    lock();
+
+    double temperature = temperatureProvider ? temperatureProvider->getCurrentTemperature() : DBL_MIN;
+
+    unlock();
+
+    return temperature;
+}
+
+TemperatureProvider *AtlasTemperatureCompensatedSensor::getTemperatureProvider() {
+    lock();
+
+    TemperatureProvider *provider = temperatureProvider;
+
+    unlock();
+
+    return provider;
+}
+
 uint32_t AtlasTemperatureCompensatedSensor::getRollingMeanNumberOfValues() {
     // store one minute of readings
     return uint32_t(ceil((60.0 * 1000.0) / double(getTemperatureCompensatedReadingResponseWaitMs())));
@@ -76,9 +96,7 @@ err_t AtlasTemperatureCompensatedSensor::sendGetReading(bool synchronous, void *
 
             if (tcSensor->isForcedTemperature) {
                 temperature = tcSensor->forcedDegreesC;
-            } else if (tcSensor->temperatureProvider) {
-                temperature = tcSensor->temperatureProvider->getCurrentTemperature();
-            } else {
+            } else if ((temperature = tcSensor->getProviderTemperature()) == DBL_MIN) {
 #if ENABLE_ATLAS_SIMULATOR
                 temperature = tcSensor->isSimulatorEnabled ? tcSensor->temperatureCompensationDegreesC : AtlasTemperatureCompensatedSensor::defaultTemperatureC;
 #else
@@ -195,9 +213,7 @@ err_t AtlasTemperatureCompensatedSensor::sendSetTemperatureCompensation(double *
             AtlasTemperatureCompensatedSensor *tcSensor = static_cast<AtlasTemperatureCompensatedSensor *>(sensor);
             double temperature;
 
-            if (tcSensor->temperatureProvider) {
-                temperature = tcSensor->temperatureProvider->getCurrentTemperature();
-            } else {
+            if ((temperature = tcSensor->getProviderTemperature()) == DBL_MIN) {
 #if ENABLE_ATLAS_SIMULATOR
                 temperature = tcSensor->isSimulatorEnabled ? tcSensor->temperatureCompensationDegreesC : AtlasTemperatureCompensatedSensor::defaultTemperatureC;
 #else
@@ -262,9 +278,7 @@ err_t AtlasTemperatureCompensatedSensor::sendSetTemperatureCompensationAndTakeRe
 
             if (tcSensor->isForcedTemperature) {
                 temperature = tcSensor->forcedDegreesC;
-            } else if (tcSensor->temperatureProvider) {
-                temperature = tcSensor->temperatureProvider->getCurrentTemperature();
-            } else {
+            } else if ((temperature = tcSensor->getProviderTemperature()) == DBL_MIN) {
 #if ENABLE_ATLAS_SIMULATOR
                 temperature = tcSensor->isSimulatorEnabled ? tcSensor->temperatureCompensationDegreesC : AtlasTemperatureCompensatedSensor::defaultTemperatureC;
 #else
@@ -296,6 +310,12 @@ err_t AtlasTemperatureCompensatedSensor::sendSetTemperatureCompensationAndTakeRe
     return err;
 }
 
+void AtlasTemperatureCompensatedSensor::setTemperatureProvider(TemperatureProvider *temperatureProvider) {
+    lock();
+    this->temperatureProvider = temperatureProvider;
+    unlock();
+}
+
 err_t AtlasTemperatureCompensatedSensor::setForcedTemperature(bool isEnabled, double forcedDegreesC, bool shouldSendSetTemperatureCompensation, bool synchronous) {
     err_t err = 0;
 
@@ -3,23 +3,28 @@
 // MIT License
 //
 
+#include <esp_timer.h>
+
+#include "common.h"
 #include "dispatchEventSource.h"
 #include "dispatchTask.h"
 
 DispatchEventSource::~DispatchEventSource() {
     removeFromDispatchTask();
+
+    _delete(payloads);
 }
 
 void DispatchEventSource::addToDispatchTask(DispatchTask *task) {
-    bool needsRelease = false;
+    // only taken when moving between tasks, the old task's list may hold the last reference
+    Ref<DispatchEventSource> self;
 
     if (!task) task = &DispatchTask::shared();
 
     if (dispatchTask) {
         if (dispatchTask == task) return;
 
-        retain();
-        needsRelease = true;
+        self.reset(this);
 
         dispatchTask->remove(this);
     }
@@ -27,8 +32,6 @@ void DispatchEventSource::addToDispatchTask(DispatchTask *task) {
     task->add(this);
 
     dispatchTask = task;
-
-    if (needsRelease) release();
 }
 
 void DispatchEventSource::clearEvents() {
@@ -36,8 +39,37 @@ void DispatchEventSource::clearEvents() {
 }
 
 void DispatchEventSource::dispatchEvent(bool fromISR) {
+    DispatchTask *task = dispatchTask;
+
     ++eventCount;
-    dispatchTask->notify(fromISR);
+
+    if (task) task->enqueue(this, fromISR);
+}
+
+void DispatchEventSource::dispatchEventWithPayload(uint32_t data, bool fromISR) {
+    // capture the time before anything else so inter-event timing is as tight as possible
+    Payload payload = { data, esp_timer_get_time() };
+
+    if (payloads) payloads->push(payload);
+
+    dispatchEvent(fromISR);
+}
+
+size_t DispatchEventSource::drainPayloads(Payload *payloads, size_t maxCount) {
+    return this->payloads ? this->payloads->pop(payloads, maxCount) : 0;
+}
+
+err_t DispatchEventSource::enablePayloads(size_t capacity) {
+    if (payloads) return EALREADY;
+
+    err_t err = 0;
+
+    if ((payloads = new SPSCRing<Payload>()) == nullptr) setErr(ENOMEM);
+    if (!err) err = payloads->init(capacity);
+
+    if (err) _delete(payloads);
+
+    return err;
 }
 
 void DispatchEventSource::eventCallback(void *context) {
@@ -47,7 +79,9 @@ void DispatchEventSource::eventCallback(void *context) {
 
 void DispatchEventSource::eventCallbackFromISR(void *context) {
     DispatchEventSource *eventSource = static_cast<DispatchEventSource *>(context);
-    eventSource->dispatchEvent(true);
+
+    if (eventSource->payloads) eventSource->dispatchEventWithPayload(0, true);
+    else eventSource->dispatchEvent(true);
 }
 
 err_t DispatchEventSource::init(EventHandler eventHandler, void *context, DispatchTask *task) {
@@ -0,0 +1,88 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#include "common.h"
+#include "dispatchPool.h"
+
+DispatchPool::~DispatchPool() {
+    for (size_t i = 0; i < tasksCount; ++i) {
+        tasks[i]->stopTask(true);
+        _delete(tasks[i]);
+    }
+}
+
+DispatchTask *DispatchPool::getTask(BaseType_t coreID) {
+    if (tasksCount == 0) return &DispatchTask::shared();
+    if (coreID >= 0 && size_t(coreID) < tasksCount) return tasks[coreID];
+
+    uint32_t i = ++nextTask;
+
+    return tasks[i % tasksCount];
+}
+
+err_t DispatchPool::init(const char *taskNamePrefix) {
+    if (tasksCount) return EALREADY;
+
+    err_t err = 0;
+    char taskName[configMAX_TASK_NAME_LEN];
+
+    for (BaseType_t coreID = 0; !err && coreID < portNUM_PROCESSORS; ++coreID) {
+        DispatchTask *task = new DispatchTask(false, coreID);
+
+        if (task == nullptr) setErr(ENOMEM);
+        if (!err) {
+            task->pool = this;
+            snprintf(taskName, sizeof(taskName), "%s%d", taskNamePrefix, coreID);
+            err = task->init(taskName);
+        }
+
+        if (!err) tasks[tasksCount++] = task;
+        else delete task;
+    }
+
+    if (err) {
+        while (tasksCount > 0) {
+            tasks[--tasksCount]->stopTask(true);
+            _delete(tasks[tasksCount]);
+        }
+    }
+
+    return err;
+}
+
+void DispatchPool::notifyIdle(DispatchTask *busyTask, bool fromISR) {
+    for (size_t i = 0; i < tasksCount; ++i) {
+        if (tasks[i] != busyTask && !tasks[i]->isHandling) {
+            tasks[i]->notify(fromISR);
+            break;
+        }
+    }
+}
+
+DispatchPool &DispatchPool::shared() {
+    static DispatchPool *singleton = new DispatchPool();
+
+    return *singleton;
+}
+
+DispatchEventSource *DispatchPool::steal(DispatchTask *thief, DispatchTask *&victim) {
+    for (size_t i = 0; i < tasksCount; ++i) {
+        DispatchTask *task = tasks[i];
+
+        // an idle worker gets to its own queue soon enough, only help one stuck in a handler
+        if (task == thief || !task->isHandling || !task->hasReady()) continue;
+
+        DispatchEventSource *eventSource = task->popReady();
+
+        if (eventSource) {
+            victim = task;
+            ++steals;
+
+            return eventSource;
+        }
+    }
+
+    return nullptr;
+}
@@ -3,17 +3,378 @@
 // MIT License
 //
 
+#include <esp_timer.h>
+
+#include "common.h"
+#include "dispatchPool.h"
 #include "dispatchTask.h"
 
+// idle WorkItems beyond this are returned to the heap
+#define MAX_FREE_WORK_ITEMS     16
+
+DispatchTask::WorkItem *DispatchTask::freeWorkItems = nullptr;
+size_t DispatchTask::freeWorkItemsCount = 0;
+portMUX_TYPE DispatchTask::freeWorkItemsLock = portMUX_INITIALIZER_UNLOCKED;
+
+class DispatchTask::WorkSource : public DispatchEventSource {
+
+public:
+
+    const char *                getName() const override { return "DispatchTask::async"; }
+
+};
+
+// --- DispatchTask ---
+
+DispatchTask::~DispatchTask() {
+    WorkItem *item;
+
+    if (workSource) {
+        workSource->removeFromDispatchTask();
+        workSource->release();
+    }
+
+    // callables that never ran are destroyed without being called
+    while ((item = workHead) != nullptr) {
+        workHead = item->next;
+        item->destroy(item->callable);
+        freeWorkItem(item);
+    }
+}
+
 void DispatchTask::add(DispatchEventSource *eventSource) {
     sourcesLock.lock();
     sources.append(eventSource);
     sourcesLock.unlock();
 }
 
+DispatchTask::WorkItem *DispatchTask::allocateWorkItem() {
+    WorkItem *item;
+
+    portENTER_CRITICAL(&freeWorkItemsLock);
+
+    if ((item = freeWorkItems) != nullptr) {
+        freeWorkItems = item->next;
+        --freeWorkItemsCount;
+    }
+
+    portEXIT_CRITICAL(&freeWorkItemsLock);
+
+    // a recycled item is reset, its callable was destroyed when it was freed
+    if (item) new (item) WorkItem();
+    else item = new WorkItem();
+
+    return item;
+}
+
+#if ENABLE_DISPATCH_PROFILER
+cJSON *DispatchTask::createProfileJSON() {
+    cJSON *array = nullptr;
+    err_t err = 0;
+    cJSON *profile = nullptr, *root = nullptr;
+
+    if ((root = cJSON_CreateObject()) == nullptr) setErr(ENOMEM);
+    if (!err && (profile = cJSON_AddObjectToObject(root, "dispatchProfile")) == nullptr) setErr(ENOMEM);
+    if (!err && cJSON_AddStringToObject(profile, "task", getTaskName()) == nullptr) setErr(ENOMEM);
+    if (!err && cJSON_AddNumberToObject(profile, "budgetMicroseconds", DISPATCH_PROFILER_BUDGET_MICROSECONDS) == nullptr) setErr(ENOMEM);
+    if (!err && cJSON_AddNumberToObject(profile, "stalls", stalls) == nullptr) setErr(ENOMEM);
+    if (!err && (array = cJSON_AddArrayToObject(profile, "sources")) == nullptr) setErr(ENOMEM);
+    if (!err) {
+        sourcesLock.lock();
+
+        sources.iterate([&](DispatchEventSource *source) {
+            const DispatchEventSource::Profile &p = source->profile;
+            cJSON *item;
+
+            if ((item = cJSON_CreateObject()) == nullptr || !cJSON_AddItemToArray(array, item)) {
+                cJSON_Delete(item);
+                setErr(ENOMEM);
+                return false;
+            }
+
+            if (cJSON_AddStringToObject(item, "name", source->getName()) == nullptr ||
+                cJSON_AddNumberToObject(item, "events", p.events) == nullptr ||
+                cJSON_AddNumberToObject(item, "meanLatencyMicroseconds", p.events ? double(p.totalLatencyMicroseconds) / p.events : 0) == nullptr ||
+                cJSON_AddNumberToObject(item, "maxLatencyMicroseconds", p.maxLatencyMicroseconds) == nullptr ||
+                cJSON_AddNumberToObject(item, "meanRunMicroseconds", p.events ? double(p.totalRunMicroseconds) / p.events : 0) == nullptr ||
+                cJSON_AddNumberToObject(item, "maxRunMicroseconds", p.maxRunMicroseconds) == nullptr ||
+                cJSON_AddNumberToObject(item, "overBudget", p.overBudget) == nullptr)
+            {
+                setErr(ENOMEM);
+            }
+
+            return !err;
+        });
+
+        sourcesLock.unlock();
+    }
+
+    if (err) {
+        cJSON_Delete(root);
+        root = nullptr;
+    }
+
+    return root;
+}
+#endif
+
+void DispatchTask::drainWork(void *context, DispatchEventSource *source) {
+    DispatchTask *task = static_cast<DispatchTask *>(context);
+    WorkItem *batch, *last = nullptr;
+    size_t count = 0;
+    bool hasMore;
+
+    portENTER_CRITICAL(&task->workLock);
+
+    batch = task->workHead;
+
+    for (WorkItem *item = batch; item && count < maxWorkItemsPerEvent; item = item->next, ++count) last = item;
+
+    if (last) {
+        if ((task->workHead = last->next) == nullptr) task->workTail = nullptr;
+        last->next = nullptr;
+    }
+    hasMore = task->workHead != nullptr;
+
+    portEXIT_CRITICAL(&task->workLock);
+
+    // submit() only dispatches an event when the queue goes from empty to non-empty,
+    // so a leftover tail needs its own event. It goes to the back of the ready queue.
+    if (hasMore) source->dispatchEvent();
+
+    while (batch) {
+        WorkItem *item = batch;
+
+        batch = item->next;
+
+        item->invoke(item->callable);
+        item->destroy(item->callable);
+        freeWorkItem(item);
+    }
+}
+
+void DispatchTask::enqueue(DispatchEventSource *eventSource, bool fromISR) {
+    bool expected = false;
+
+    // pairs with the fence in run(), eventCount must be visible before isQueued is tested
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_compare_exchange_n(&eventSource->isQueued, &expected, true, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        // the ready queue holds a reference, released by run()
+        eventSource->retain();
+        eventSource->readyAt = esp_timer_get_time();
+
+        lanes[uint8_t(eventSource->priority)].ready.push(eventSource);
+    }
+
+    notify(fromISR);
+
+    // an idle sibling can take over what this worker can't get to
+    if (pool && isHandling) pool->notifyIdle(this, fromISR);
+}
+
+void DispatchTask::fileReady(Lane &lane) {
+    DispatchEventSource *ready = lane.ready.popAll();
+
+    while (ready) {
+        DispatchEventSource *eventSource = ready;
+
+        ready = eventSource->readyNext;
+        eventSource->readyNext = nullptr;
+
+        if (eventSource->deadlineMicroseconds) {
+            eventSource->readyChild = nullptr;
+            eventSource->readyDeadline = eventSource->readyAt + eventSource->deadlineMicroseconds;
+            eventSource->readySequence = lane.sequence++;
+
+            lane.deadlines = meldDeadlines(lane.deadlines, eventSource);
+        } else {
+            if (lane.fifoTail) lane.fifoTail->readyNext = eventSource;
+            else lane.fifo = eventSource;
+            lane.fifoTail = eventSource;
+        }
+    }
+}
+
+void DispatchTask::freeWorkItem(WorkItem *item) {
+    portENTER_CRITICAL(&freeWorkItemsLock);
+
+    bool shouldKeep = freeWorkItemsCount < MAX_FREE_WORK_ITEMS;
+
+    if (shouldKeep) {
+        item->next = freeWorkItems;
+        freeWorkItems = item;
+        ++freeWorkItemsCount;
+    }
+
+    portEXIT_CRITICAL(&freeWorkItemsLock);
+
+    if (!shouldKeep) delete item;
+}
+
+DispatchTask::LaneStatistics DispatchTask::getLaneStatistics(DispatchEventSource::Priority priority) {
+    portENTER_CRITICAL(&readyLock);
+
+    LaneStatistics result = lanes[uint8_t(priority)].statistics;
+
+    portEXIT_CRITICAL(&readyLock);
+
+    return result;
+}
+
+bool DispatchTask::hasReady() {
+    bool hasReady = false;
+
+    portENTER_CRITICAL(&readyLock);
+
+    for (Lane &lane : lanes) {
+        if ((hasReady = lane.deadlines || lane.fifo || !lane.ready.isEmpty())) break;
+    }
+
+    portEXIT_CRITICAL(&readyLock);
+
+    return hasReady;
+}
+
 err_t DispatchTask::init(const char *taskName) {
-    return startTask(taskName);
+    err_t err = 0;
+
+    if (!workSource && (workSource = new WorkSource()) == nullptr) setErr(ENOMEM);
+    if (!err) err = workSource->init(drainWork, this, this);
+    if (!err) err = startTask(taskName);
+
+    return err;
+}
+
+DispatchEventSource *DispatchTask::meldDeadlines(DispatchEventSource *a, DispatchEventSource *b) {
+    if (a == nullptr) return b;
+    if (b == nullptr) return a;
+
+    // the earlier deadline becomes the root, equal deadlines go in arrival order
+    if (b->readyDeadline < a->readyDeadline || (b->readyDeadline == a->readyDeadline && int32_t(b->readySequence - a->readySequence) < 0)) {
+        std::swap(a, b);
+    }
+
+    b->readyNext = a->readyChild;
+    a->readyChild = b;
+
+    return a;
+}
+
+DispatchEventSource *DispatchTask::popDeadline(DispatchEventSource *&heap) {
+    DispatchEventSource *root = heap, *child = root->readyChild, *pairs = nullptr;
+
+    // the usual two passes: meld the children in pairs left to right, then fold the pairs
+    // together right to left
+    while (child) {
+        DispatchEventSource *a = child, *b = a->readyNext;
+
+        if (b == nullptr) {
+            a->readyNext = pairs;
+            pairs = a;
+            break;
+        }
+
+        child = b->readyNext;
+        a->readyNext = b->readyNext = nullptr;
+
+        DispatchEventSource *pair = meldDeadlines(a, b);
+
+        pair->readyNext = pairs;
+        pairs = pair;
+    }
+
+    heap = nullptr;
+
+    while (pairs) {
+        DispatchEventSource *pair = pairs;
+
+        pairs = pair->readyNext;
+        pair->readyNext = nullptr;
+        heap = meldDeadlines(heap, pair);
+    }
+
+    root->readyChild = root->readyNext = nullptr;
+
+    return root;
+}
+
+DispatchEventSource *DispatchTask::popReady() {
+    DispatchEventSource *eventSource = nullptr;
+
+    portENTER_CRITICAL(&readyLock);
+
+    for (Lane &lane : lanes) {
+        fileReady(lane);
+
+        if (lane.deadlines) {
+            eventSource = popDeadline(lane.deadlines);
+        } else if ((eventSource = lane.fifo) != nullptr) {
+            if ((lane.fifo = eventSource->readyNext) == nullptr) lane.fifoTail = nullptr;
+        } else {
+            continue;
+        }
+
+        int64_t now = esp_timer_get_time();
+        uint32_t delay = uint32_t(now - eventSource->readyAt);
+        LaneStatistics &statistics = lane.statistics;
+
+        eventSource->readyNext = nullptr;
+
+        ++statistics.events;
+        statistics.totalQueueingDelayMicroseconds += delay;
+        if (delay > statistics.maxQueueingDelayMicroseconds) statistics.maxQueueingDelayMicroseconds = delay;
+        if (eventSource->deadlineMicroseconds && delay > eventSource->deadlineMicroseconds) ++statistics.missedDeadlines;
+
+        break;
+    }
+
+    portEXIT_CRITICAL(&readyLock);
+
+    return eventSource;
+}
+
+#if ENABLE_DISPATCH_PROFILER
+void DispatchTask::logProfileSummary() {
+    sourcesLock.lock();
+
+    logi("dispatch profile for %s, %lu stalls", getTaskName(), stalls);
+
+    sources.iterate([&](DispatchEventSource *source) {
+        const DispatchEventSource::Profile &p = source->profile;
+
+        if (p.events) {
+            logi("  %s: %lu events, latency mean/max %llu/%lu us, run mean/max %llu/%lu us, %lu over budget",
+                source->getName(), p.events,
+                p.totalLatencyMicroseconds / p.events, p.maxLatencyMicroseconds,
+                p.totalRunMicroseconds / p.events, p.maxRunMicroseconds,
+                p.overBudget);
+        }
+
+        return true;
+    });
+
+    sourcesLock.unlock();
+}
+
+void DispatchTask::profile(DispatchEventSource *eventSource, int64_t startedAt, int64_t finishedAt) {
+    DispatchEventSource::Profile &p = eventSource->profile;
+    uint32_t latency = uint32_t(startedAt - eventSource->readyAt);
+    uint64_t run = uint64_t(finishedAt - startedAt);
+
+    ++p.events;
+    p.totalLatencyMicroseconds += latency;
+    p.totalRunMicroseconds += run;
+    if (latency > p.maxLatencyMicroseconds) p.maxLatencyMicroseconds = latency;
+    if (run > p.maxRunMicroseconds) p.maxRunMicroseconds = uint32_t(run);
+    if (run > DISPATCH_PROFILER_BUDGET_MICROSECONDS) ++p.overBudget;
+
+    if (run > DISPATCH_PROFILER_STALL_MICROSECONDS) {
+        ++stalls;
+        logw("%s handler %s ran %llu ms, the task watchdog fires at %d s", getTaskName(), eventSource->getName(), run / 1000, TASK_WATCHDOG_TIMEOUT_SECONDS);
+    }
 }
+#endif
 
 void DispatchTask::remove(DispatchEventSource *eventSource) {
     sourcesLock.lock();
@@ -22,44 +383,53 @@ void DispatchTask::remove(DispatchEventSource *eventSource) {
 }
 
 void DispatchTask::run() {
-    size_t eventCount, sourcesCount;
-    DispatchEventSource *eventSource = nullptr;
+    DispatchEventSource *eventSource;
+    size_t eventsHandled = 0;
 
-    if (!(eventCount = wait(TASK_MAX_WAIT_TICKS))) return;
+    if (!wait(TASK_MAX_WAIT_TICKS)) return;
 
-    do {
-        // find and process pending events
-        sourcesLock.lock();
+    while (eventsHandled < maxEventsPerRun) {
+        // owner is the task whose queue the source came from, a sibling's when stolen
+        DispatchTask *owner = this;
 
-        eventSource = nullptr;
-        sourcesCount = sources.count();
+        if ((eventSource = popReady()) == nullptr && pool) eventSource = pool->steal(this, owner);
+        if (eventSource == nullptr) break;
 
-        sources.iterate([&](DispatchEventSource *source) {
-            if (source->eventCount.decrement()) {
-                eventSource = source;
-                return false;
-            }
-            return true;
-        });
+        // a source removed from (or moved off) its task since it was queued is skipped
+        if (eventSource->dispatchTask == owner && eventSource->eventCount.decrement()) {
+            // hand any backlog to an idle sibling before settling into the handler
+            if (pool && hasReady()) pool->notifyIdle(this, false);
 
-        if (eventSource) {
-            eventSource->retain();
-            // Move the event source to the end of the sources list
-            // to provide fair event processing for other sources.
-            sources.splice(sources, eventSource, sourcesCount);
-        }
-
-        sourcesLock.unlock();
-
-        if (eventSource) {
             if (eventSource->eventHandler) {
+#if ENABLE_DISPATCH_PROFILER
+                int64_t startedAt = esp_timer_get_time();
+#endif
+                isHandling = true;
                 eventSource->eventHandler(eventSource->context, eventSource);
+                isHandling = false;
+#if ENABLE_DISPATCH_PROFILER
+                profile(eventSource, startedAt, esp_timer_get_time());
+#endif
             }
-            eventSource->release();
 
-            --eventCount;
+            ++eventsHandled;
         }
-    } while (eventCount > 0 && eventSource);
+
+        // isQueued was held through the handler so the source couldn't be queued twice,
+        // which is also what keeps a source's handler from running on two workers at once.
+        // Events dispatched meanwhile were counted but not queued, so recheck after clearing.
+        __atomic_store_n(&eventSource->isQueued, false, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        DispatchTask *task = eventSource->dispatchTask;
+
+        if (task && eventSource->eventCount > 0) task->enqueue(eventSource, false);
+
+        eventSource->release();
+    }
+
+    // more is ready, come straight back after the runloop resets the watchdog
+    if (eventsHandled == maxEventsPerRun && hasReady()) notify();
 }
 
 DispatchTask &DispatchTask::shared() {
@@ -67,3 +437,76 @@ DispatchTask &DispatchTask::shared() {
 
     return singleton;
 }
+
+#if ENABLE_DISPATCH_PROFILER
+err_t DispatchTask::startProfileSummary(uint32_t intervalSeconds) {
+    if (profileTimer) return EALREADY;
+
+    err_t err = 0;
+
+    if ((profileTimer = new DispatchTimerSource()) == nullptr) setErr(ENOMEM);
+    if (!err) {
+        err = profileTimer->init([](void *context, DispatchEventSource *source) {
+            static_cast<DispatchTask *>(context)->logProfileSummary();
+        }, this, "DispatchProfiler", this);
+    }
+    if (!err) err = profileTimer->startPeriodic(uint64_t(intervalSeconds) * 1000000, 1000000);
+
+    if (err) _release(profileTimer);
+
+    return err;
+}
+#endif
+
+err_t DispatchTask::submit(WorkItem *item) {
+    bool wasEmpty;
+
+    // the work source is created by init(), without it nothing would ever run item
+    if (workSource == nullptr) {
+        item->destroy(item->callable);
+        freeWorkItem(item);
+        return EINVAL;
+    }
+
+    item->next = nullptr;
+
+    portENTER_CRITICAL(&workLock);
+
+    if ((wasEmpty = workTail == nullptr)) workHead = item;
+    else workTail->next = item;
+    workTail = item;
+
+    portEXIT_CRITICAL(&workLock);
+
+    // one event covers everything queued until drainWork() next takes a batch
+    if (wasEmpty) workSource->dispatchEvent();
+
+    return 0;
+}
+
+err_t DispatchTask::submitAfter(WorkItem *item, uint64_t delayMicroseconds, uint32_t slackMicroseconds) {
+    err_t err = 0;
+
+    // as for submit(), nothing would run item without init()'s work source
+    if (workSource == nullptr) err = EINVAL;
+    if (!err) {
+        item->task = this;
+        item->timer.callback = workTimerFired;
+        item->timer.context = item;
+
+        err = DispatchTimerWheel::shared().start(&item->timer, delayMicroseconds, 0, slackMicroseconds);
+    }
+
+    if (err) {
+        item->destroy(item->callable);
+        freeWorkItem(item);
+    }
+
+    return err;
+}
+
+void DispatchTask::workTimerFired(DispatchTimerWheel::Timer *timer) {
+    WorkItem *item = static_cast<WorkItem *>(timer->context);
+
+    item->task->submit(item);
+}
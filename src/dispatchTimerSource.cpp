@@ -6,30 +6,15 @@
 #include "dispatchTimerSource.h"
 
 DispatchTimerSource::~DispatchTimerSource() {
-    if (timer) {
-        esp_timer_stop(timer);
-        esp_timer_delete(timer);
-    }
+    stop();
 }
 
 err_t DispatchTimerSource::init(EventHandler eventHandler, void *context, const char *timerName, DispatchTask *task) {
-    esp_timer_create_args_t config = {
-        .callback = eventCallback,
-        .arg = this,
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = timerName,
-        .skip_unhandled_events = true
-    };
-
-    err_t err = esp_timer_create(&config, &timer);
-
-    if (!err) err = DispatchEventSource::init(eventHandler, context, task);
-    if (err && timer) {
-        esp_timer_delete(timer);
-        timer = nullptr;
-    }
-
-    return err;
+    name = timerName;
+    timer.callback = timerFired;
+    timer.context = this;
+
+    return DispatchEventSource::init(eventHandler, context, task);
 }
 
 void DispatchTimerSource::removeFromDispatchTask() {
@@ -38,14 +23,18 @@ void DispatchTimerSource::removeFromDispatchTask() {
     DispatchEventSource::removeFromDispatchTask();
 }
 
-err_t DispatchTimerSource::startOnce(uint64_t timeoutMicroseconds) {
-    return timer ? esp_timer_start_once(timer, timeoutMicroseconds) : EINVAL;
+err_t DispatchTimerSource::startOnce(uint64_t timeoutMicroseconds, uint32_t slackMicroseconds) {
+    return timer.callback ? DispatchTimerWheel::shared().start(&timer, timeoutMicroseconds, 0, slackMicroseconds) : EINVAL;
 }
 
-err_t DispatchTimerSource::startPeriodic(uint64_t periodMicroseconds) {
-    return timer ? esp_timer_start_periodic(timer, periodMicroseconds) : EINVAL;
+err_t DispatchTimerSource::startPeriodic(uint64_t periodMicroseconds, uint32_t slackMicroseconds) {
+    return timer.callback ? DispatchTimerWheel::shared().start(&timer, periodMicroseconds, periodMicroseconds, slackMicroseconds) : EINVAL;
 }
 
 void DispatchTimerSource::stop() {
-    if (timer) esp_timer_stop(timer);
+    if (timer.callback) DispatchTimerWheel::shared().stop(&timer);
+}
+
+void DispatchTimerSource::timerFired(DispatchTimerWheel::Timer *timer) {
+    static_cast<DispatchTimerSource *>(timer->context)->dispatchEvent();
 }
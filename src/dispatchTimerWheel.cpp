@@ -0,0 +1,339 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#include "common.h"
+#include "dispatchTimerWheel.h"
+
+#define SLOT_MASK                   (DispatchTimerWheel::slotsPerLevel - 1)
+
+// Round deadline up to the coarsest boundary that still lies within deadline + slack.
+// Timers with nearby deadlines and similar slack land on the same tick.
+static uint64_t applySlack(uint64_t deadline, uint32_t slack) {
+    if (slack == 0) return deadline;
+
+    uint64_t limit = deadline + slack;
+    uint64_t mask = (1ull << (63 - __builtin_clzll(deadline ^ limit))) - 1;
+
+    return limit & ~mask;
+}
+
+static uint64_t microsecondsToTicks(uint64_t microseconds) {
+    return (microseconds + DispatchTimerWheel::tickMicroseconds - 1) / DispatchTimerWheel::tickMicroseconds;
+}
+
+// --- DispatchTimerWheel ---
+
+DispatchTimerWheel::DispatchTimerWheel() :
+    epochMicroseconds(esp_timer_get_time()),
+    statisticsLoggedAt(epochMicroseconds)
+{ }
+
+DispatchTimerWheel::~DispatchTimerWheel() {
+#if !ELIDE_DESTRUCTORS_FOR_SINGLETONS
+    if (hardwareTimer) {
+        esp_timer_stop(hardwareTimer);
+        esp_timer_delete(hardwareTimer);
+    }
+#endif
+}
+
+void DispatchTimerWheel::advance(uint64_t toTick) {
+    uint64_t tick;
+
+    // jump straight from one tick with work to the next rather than stepping through
+    // empty slots. nextEventTick() stops at every cascade so no slot is skipped.
+    while ((tick = nextEventTick()) <= toTick) {
+        currentTick = tick;
+
+        if ((tick & SLOT_MASK) == 0) cascade(tick);
+
+        expire(tick);
+    }
+
+    if (currentTick < toTick) currentTick = toTick;
+}
+
+void DispatchTimerWheel::cascade(uint64_t tick) {
+    Timer *timer;
+
+    // Each higher level slot is cascaded when the level below it wraps.
+    for (uint8_t level = 1; level < levels; ++level) {
+        uint8_t slot = (tick >> (slotBits * level)) & SLOT_MASK;
+
+        while ((timer = slots[level][slot]) != nullptr) {
+            remove(timer);
+            insert(timer);
+            ++statistics.cascades;
+        }
+
+        if (slot) break;
+    }
+}
+
+void DispatchTimerWheel::coalesce(uint64_t tick) {
+    Timer *timer, *next;
+
+    // Only level 0 is searched, a window reaching beyond it wakes for a cascade anyway.
+    // Gather the due timers in one sweep, then fire them in deadline order. Callbacks may
+    // stop or restart timers still waiting in coalescing, remove() takes them out of it.
+    // A restarted or periodic timer is filed in the wheel after tick, so the pass ends.
+    for (uint64_t bits = occupancy[0]; bits; bits &= bits - 1) {
+        for (timer = slots[0][__builtin_ctzll(bits)]; timer; timer = next) {
+            next = timer->next;
+
+            if (timer->deadlineTick > tick) continue;
+
+            remove(timer);
+            timer->isActive = true;
+            timer->level = levels;
+            coalescing.append(timer);
+            ++activeTimers;
+        }
+    }
+
+    coalescing.sort([](Timer *a, Timer *b) { return a->deadlineTick < b->deadlineTick; });
+
+    while ((timer = coalescing[0]) != nullptr) {
+        ++statistics.coalesced;
+
+        fire(timer, tick);
+    }
+}
+
+void DispatchTimerWheel::expire(uint64_t tick) {
+    uint8_t slot = tick & SLOT_MASK;
+    Timer *timer;
+
+    // Callbacks may stop or start other timers, so take one timer at a time from the
+    // slot rather than walking it. Nothing started from here can land in this slot.
+    while ((timer = slots[0][slot]) != nullptr) fire(timer, tick);
+}
+
+void DispatchTimerWheel::fire(Timer *timer, uint64_t tick) {
+    remove(timer);
+
+    if (timer->deadlineTick != lastFiredDeadlineTick) {
+        lastFiredDeadlineTick = timer->deadlineTick;
+        ++statistics.requestedWakeups;
+    }
+
+    if (timer->periodTicks) {
+        timer->deadlineTick += timer->periodTicks;
+
+        // like esp_timer's skip_unhandled_events, a late periodic timer doesn't fire to catch up
+        if (timer->deadlineTick <= tick) timer->deadlineTick = tick + timer->periodTicks;
+
+        timer->expiryTick = applySlack(timer->deadlineTick, timer->slackTicks);
+        insert(timer);
+    }
+
+    ++statistics.fired;
+
+    timer->callback(timer);
+}
+
+uint64_t DispatchTimerWheel::getCurrentTick() {
+    return uint64_t(esp_timer_get_time() - epochMicroseconds) / tickMicroseconds;
+}
+
+DispatchTimerWheel::Statistics DispatchTimerWheel::getStatistics() {
+    lock.lock();
+
+    Statistics result = statistics;
+
+    result.activeTimers = activeTimers;
+    for (uint8_t level = 0; level < levels; ++level) {
+        result.occupiedSlots[level] = __builtin_popcountll(occupancy[level]);
+    }
+
+    lock.unlock();
+
+    return result;
+}
+
+void DispatchTimerWheel::insert(Timer *timer) {
+    if (timer->expiryTick <= currentTick) timer->expiryTick = currentTick + 1;
+
+    uint64_t delta = timer->expiryTick - currentTick;
+    uint64_t filedTick = timer->expiryTick;
+    uint8_t level;
+
+    for (level = 0; level < levels - 1 && delta >= 1ull << (slotBits * (level + 1)); ++level) ;
+
+    // beyond the range of the wheel, park it in the furthest slot and let cascading refile it
+    if (delta >= 1ull << (slotBits * levels)) filedTick = currentTick + (1ull << (slotBits * levels)) - 1;
+
+    uint8_t slot = (filedTick >> (slotBits * level)) & SLOT_MASK;
+    Timer *head = slots[level][slot];
+
+    timer->isActive = true;
+    timer->level = level;
+    timer->next = head;
+    timer->prev = nullptr;
+    timer->slot = slot;
+
+    if (head) head->prev = timer;
+
+    slots[level][slot] = timer;
+    occupancy[level] |= 1ull << slot;
+
+    ++activeTimers;
+}
+
+void DispatchTimerWheel::logStatistics() {
+    int64_t now = esp_timer_get_time();
+
+    lock.lock();
+
+    Statistics current = statistics;
+    Statistics previous = loggedStatistics;
+    uint32_t active = uint32_t(activeTimers);
+    double seconds = double(now - statisticsLoggedAt) / 1000000;
+
+    loggedStatistics = current;
+    statisticsLoggedAt = now;
+
+    lock.unlock();
+
+    if (seconds <= 0) return;
+
+    logi("timer wheel: %.1f wake-ups/s, %.1f/s without coalescing, %lu timers coalesced, %lu active",
+        (current.wakeups - previous.wakeups) / seconds,
+        (current.requestedWakeups - previous.requestedWakeups) / seconds,
+        current.coalesced - previous.coalesced,
+        active);
+}
+
+uint64_t DispatchTimerWheel::nextEventTick() {
+    uint64_t result = UINT64_MAX;
+
+    for (uint8_t level = 0; level < levels; ++level) {
+        uint64_t bits = occupancy[level];
+
+        if (!bits) continue;
+
+        uint8_t shift = slotBits * level;
+        uint64_t position = currentTick >> shift;
+        uint8_t rotation = (position + 1) & SLOT_MASK;
+
+        // rotate so bit 0 is the slot after the current one, the first set bit is then the next occupied slot
+        if (rotation) bits = (bits >> rotation) | (bits << (slotsPerLevel - rotation));
+
+        // level 0 slots expire on their tick, higher level slots need waking for their cascade
+        uint64_t tick = (position + __builtin_ctzll(bits) + 1) << shift;
+
+        if (tick < result) result = tick;
+    }
+
+    return result;
+}
+
+void DispatchTimerWheel::program() {
+    uint64_t tick = nextEventTick();
+
+    if (tick == programmedTick) return;
+
+    esp_timer_stop(hardwareTimer);
+
+    programmedTick = tick;
+
+    if (tick != UINT64_MAX) {
+        int64_t delay = epochMicroseconds + int64_t(tick * tickMicroseconds) - esp_timer_get_time();
+
+        esp_timer_start_once(hardwareTimer, delay > 0 ? delay : 0);
+        ++statistics.reprograms;
+    }
+}
+
+void DispatchTimerWheel::remove(Timer *timer) {
+    if (timer->level == levels) {
+        coalescing.remove(timer);
+    } else if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else if ((slots[timer->level][timer->slot] = timer->next) == nullptr) {
+        occupancy[timer->level] &= ~(1ull << timer->slot);
+    }
+
+    if (timer->next) timer->next->prev = timer->prev;
+
+    timer->isActive = false;
+    timer->next = nullptr;
+    timer->prev = nullptr;
+
+    --activeTimers;
+}
+
+DispatchTimerWheel &DispatchTimerWheel::shared() {
+    static DispatchTimerWheel *singleton = new DispatchTimerWheel();
+
+    return *singleton;
+}
+
+err_t DispatchTimerWheel::start(Timer *timer, uint64_t timeoutMicroseconds, uint64_t periodMicroseconds, uint32_t slackMicroseconds) {
+    if (timer == nullptr || timer->callback == nullptr) return EINVAL;
+
+    err_t err = 0;
+
+    lock.lock();
+
+    if (hardwareTimer == nullptr) {
+        esp_timer_create_args_t config = {
+            .callback = timerCallback,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "DispatchTimerWheel",
+            .skip_unhandled_events = true
+        };
+
+        err = esp_timer_create(&config, &hardwareTimer);
+    }
+    if (!err) {
+        if (timer->isActive) remove(timer);
+
+        int64_t now = esp_timer_get_time() - epochMicroseconds;
+
+        // an idle wheel isn't advanced, bring it up to date so the new timer files relative to now
+        if (activeTimers == 0) currentTick = uint64_t(now) / tickMicroseconds;
+
+        // expire on the first tick at or after the requested time, never early
+        timer->deadlineTick = microsecondsToTicks(uint64_t(now) + timeoutMicroseconds);
+        timer->periodTicks = microsecondsToTicks(periodMicroseconds);
+        timer->slackTicks = slackMicroseconds / tickMicroseconds;
+        timer->expiryTick = applySlack(timer->deadlineTick, timer->slackTicks);
+
+        insert(timer);
+        program();
+    }
+
+    lock.unlock();
+
+    return err;
+}
+
+void DispatchTimerWheel::stop(Timer *timer) {
+    if (timer == nullptr) return;
+
+    lock.lock();
+
+    // The esp_timer is left programmed. If the stopped timer was the next event
+    // the wheel wakes to find nothing to do and reprograms itself.
+    if (timer->isActive) remove(timer);
+
+    lock.unlock();
+}
+
+void DispatchTimerWheel::timerCallback(void *context) {
+    DispatchTimerWheel *wheel = static_cast<DispatchTimerWheel *>(context);
+
+    wheel->lock.lock();
+
+    ++wheel->statistics.wakeups;
+    wheel->programmedTick = UINT64_MAX;
+    wheel->advance(wheel->getCurrentTick());
+    wheel->coalesce(wheel->currentTick);
+    wheel->program();
+
+    wheel->lock.unlock();
+}
@@ -10,10 +10,137 @@
 
 I2C::~I2C() {
 #if !ELIDE_DESTRUCTORS_FOR_SINGLETONS
+    stopTask(true);
     if (busHandle) i2c_del_master_bus(busHandle);
 #endif
 }
     
+err_t I2C::admit(DeviceHandle device) {
+    if (device->breakerState == BreakerState::closed) return 0;
+
+    if (device->breakerState == BreakerState::open) {
+        if (esp_timer_get_time() < device->retryAtUs) {
+            ++device->statistics.fastFails;
+            return ECONNREFUSED;
+        }
+
+        device->breakerState = BreakerState::halfOpen;
+    }
+
+    // A short probe decides whether the trial transaction is worth its full timeout.
+    if (i2c_master_probe(busHandle, device->address, breakerProbeTimeoutMs) != ESP_OK) {
+        ++device->statistics.failures;
+        openBreaker(device);
+
+        return ECONNREFUSED;
+    }
+
+    return 0;
+}
+
+err_t I2C::complete(DeviceHandle device, esp_err_t espErr, int64_t startUs, const char *operation, size_t length) {
+    uint32_t elapsedUs = uint32_t(esp_timer_get_time() - startUs);
+    err_t err = espErr;
+    Statistics &statistics = device->statistics;
+
+    statistics.lastTransactionUs = elapsedUs;
+    if (elapsedUs > statistics.maxTransactionUs) statistics.maxTransactionUs = elapsedUs;
+
+    switch (espErr) {
+        case ESP_ERR_TIMEOUT:   err = ETIMEDOUT;    break;
+        case ESP_FAIL:          err = EIO;          break;
+    }
+
+    if (!err) {
+        busConsecutiveTimeouts = 0;
+
+        if (device->breakerState != BreakerState::closed) {
+            ++statistics.recoveries;
+            logi("i2c device 0x%x recovered", device->address);
+        }
+
+        device->backoffMs = 0;
+        device->breakerState = BreakerState::closed;
+        device->consecutiveFailures = 0;
+
+        return 0;
+    }
+
+    ++statistics.failures;
+
+    // only the failures leading up to a trip are logged, an open breaker stays quiet
+    if (device->breakerState == BreakerState::closed) {
+        _loge("i2c %s %u bytes 0x%x failed: %s", operation, length, device->address, esp_err_to_name(espErr));
+    }
+
+    if (device->consecutiveFailures < UINT8_MAX) ++device->consecutiveFailures;
+    if (device->breakerState == BreakerState::halfOpen || device->consecutiveFailures >= breakerFailureThreshold) {
+        openBreaker(device);
+    }
+
+    // A timeout rather than a NACK usually means a slave is holding SDA low.
+    if (err == ETIMEDOUT) {
+        ++busStatistics.timeouts;
+
+        if (++busConsecutiveTimeouts >= busTimeoutsBeforeRecovery) {
+            busConsecutiveTimeouts = 0;
+            recoverBus();
+        }
+    }
+
+    return err;
+}
+
+void I2C::cancel(Transaction *transaction) {
+    bool isDequeued = false;
+
+    if (transaction == nullptr) return;
+
+    queueLock.lock();
+
+    for (Transaction **p = &queueHead, *previous = nullptr; *p; previous = *p, p = &(*p)->next) {
+        if (*p != transaction) continue;
+
+        if ((*p = transaction->next) == nullptr) queueTail = previous;
+        transaction->next = nullptr;
+        isDequeued = true;
+        break;
+    }
+
+    queueLock.unlock();
+
+    if (isDequeued) {
+        transaction->isPending.store(false, MemoryOrder::release);
+        transaction->completionSource->release();
+        return;
+    }
+
+    // Not queued, so it's finished or the worker has it. The worker holds runLock from
+    // before it dequeues until after it dispatches, so once we have it the worker is done.
+    runLock.lock();
+    runLock.unlock();
+}
+
+I2C::BusStatistics I2C::getBusStatistics() const {
+    busLock.lock();
+    BusStatistics statistics = busStatistics;
+    busLock.unlock();
+
+    return statistics;
+}
+
+uint32_t I2C::getRetryDelayMs(DeviceHandle device) const {
+    if (device == nullptr) return 0;
+
+    busLock.lock();
+
+    int64_t remainingUs = device->breakerState == BreakerState::open ? device->retryAtUs - esp_timer_get_time() : 0;
+
+    busLock.unlock();
+
+    return remainingUs > 0 ? uint32_t((remainingUs + 999) / 1000) : 0;
+}
+
 err_t I2C::init(uint32_t clockSpeed) {
     if (busHandle != nullptr) return EALREADY;
 
@@ -37,18 +164,44 @@ err_t I2C::init(uint32_t clockSpeed) {
     err = i2c_new_master_bus(&config, &busHandle);
 
     if (err) loge("I2C::init() failed: %s", esp_err_to_name(err));
+    if (!err) err = startTask(portNumber == I2C_NUM_0 ? "I2C0" : "I2C1");
 
     return err;
 }
 
-err_t I2C::read(DeviceHandle device, uint8_t *buffer, size_t length, uint32_t timeoutMs) {
-    if (device == nullptr || buffer == nullptr) return EINVAL;
+bool I2C::isDeviceRegistered(uint8_t address) const {
+    if (address > 127) return false;
+
+    busLock.lock();
+    bool isRegistered = registeredAddresses[address / 32] & (1ul << (address % 32));
+    busLock.unlock();
+
+    return isRegistered;
+}
+
+void I2C::openBreaker(DeviceHandle device) {
+    if (device->breakerState == BreakerState::closed) {
+        device->backoffMs = breakerInitialBackoffMs;
+        ++device->statistics.trips;
+        logw("i2c device 0x%x failed %d consecutive transactions, failing fast", device->address, device->consecutiveFailures);
+    } else if ((device->backoffMs *= 2) > breakerMaxBackoffMs) {
+        device->backoffMs = breakerMaxBackoffMs;
+    }
+
+    device->breakerState = BreakerState::open;
+    device->retryAtUs = esp_timer_get_time() + int64_t(device->backoffMs) * 1000;
+}
 
-    esp_err_t err = i2c_master_receive(device->handle, buffer, length, timeoutMs);
+err_t I2C::probe(uint8_t address, uint32_t timeoutMs) {
+    if (busHandle == nullptr) return EINVAL;
+    if (address > 127) return ERANGE;
 
-    if (err) loge("i2c.read 0x%x returned %s", device->address, esp_err_to_name(err));
+    busLock.lock();
+    esp_err_t err = i2c_master_probe(busHandle, address, timeoutMs);
+    busLock.unlock();
 
     switch (err) {
+        case ESP_ERR_NOT_FOUND: err = ENODEV;       break;
         case ESP_ERR_TIMEOUT:   err = ETIMEDOUT;    break;
         case ESP_FAIL:          err = EIO;          break;
     }
@@ -56,6 +209,42 @@ err_t I2C::read(DeviceHandle device, uint8_t *buffer, size_t length, uint32_t ti
     return err;
 }
 
+err_t I2C::read(DeviceHandle device, uint8_t *buffer, size_t length, uint32_t timeoutMs) {
+    if (device == nullptr || buffer == nullptr) return EINVAL;
+
+    busLock.lock();
+
+    err_t err = admit(device);
+
+    if (!err) {
+        int64_t startUs = esp_timer_get_time();
+
+        err = complete(device, i2c_master_receive(device->handle, buffer, length, timeoutMs), startUs, "read", length);
+    }
+
+    busLock.unlock();
+
+    return err;
+}
+
+err_t I2C::recoverBus() {
+    if (busHandle == nullptr) return EINVAL;
+
+    busLock.lock();
+
+    esp_err_t err = i2c_master_bus_reset(busHandle);
+
+    ++busStatistics.recoveries;
+    if (err) ++busStatistics.recoveryFailures;
+
+    busLock.unlock();
+
+    if (err) loge("i2c bus %d recovery failed: %s", portNumber, esp_err_to_name(err));
+    else logw("i2c bus %d reset", portNumber);
+
+    return err;
+}
+
 err_t I2C::registerDevice(uint8_t address, DeviceHandle &device) {
     i2c_device_config_t config = {
         .dev_addr_length = I2C_ADDR_BIT_LEN_7,
@@ -69,10 +258,17 @@ err_t I2C::registerDevice(uint8_t address, DeviceHandle &device) {
 
     deviceHandle->address = address;
 
+    busLock.lock();
+
     err_t err = i2c_master_bus_add_device(busHandle, &config, &deviceHandle->handle);
 
-    if (!err) device = deviceHandle;
-    else {
+    if (!err) registeredAddresses[address / 32] |= 1ul << (address % 32);
+
+    busLock.unlock();
+
+    if (!err) {
+        device = deviceHandle;
+    } else {
         _loge("failed to register i2c device 0x%x, err is %s", address, esp_err_to_name(err));
         delete deviceHandle;
     }
@@ -80,6 +276,46 @@ err_t I2C::registerDevice(uint8_t address, DeviceHandle &device) {
     return err;
 }
 
+void I2C::run() {
+    Transaction *transaction;
+
+    if (!wait(TASK_MAX_WAIT_TICKS)) return;
+
+    for (;;) {
+        runLock.lock();
+        queueLock.lock();
+
+        if ((transaction = queueHead) != nullptr) {
+            if ((queueHead = transaction->next) == nullptr) queueTail = nullptr;
+            transaction->next = nullptr;
+        }
+
+        queueLock.unlock();
+
+        if (transaction == nullptr) {
+            runLock.unlock();
+            break;
+        }
+
+        DispatchEventSource *completionSource = transaction->completionSource;
+
+        if (transaction->operation == Transaction::Operation::read) {
+            transaction->err = read(transaction->device, transaction->buffer, transaction->length, transaction->timeoutMs);
+        } else {
+            transaction->err = write(transaction->device, transaction->buffer, transaction->length, transaction->timeoutMs);
+        }
+
+        // the transaction belongs to the submitter again once isPending is cleared,
+        // completionSource was retained by submit() so it's still safe to use here.
+        transaction->isPending.store(false, MemoryOrder::release);
+
+        completionSource->dispatchEvent();
+        completionSource->release();
+
+        runLock.unlock();
+    }
+}
+
 I2C &I2C::shared(i2c_port_num_t portNumber) {
     static I2C *singletons[I2C_NUM_MAX] = {};
 
@@ -90,11 +326,40 @@ I2C &I2C::shared(i2c_port_num_t portNumber) {
     return *singletons[portNumber];
 }
 
+err_t I2C::submit(Transaction *transaction) {
+    if (transaction == nullptr || transaction->device == nullptr || transaction->buffer == nullptr) return EINVAL;
+    if (transaction->completionSource == nullptr || transaction->isPending.load(MemoryOrder::acquire)) return EINVAL;
+    if (!isTaskActive()) return EINVAL;
+
+    transaction->completionSource->retain();
+    transaction->err = 0;
+    transaction->isPending.store(true, MemoryOrder::relaxed);
+    transaction->next = nullptr;
+
+    queueLock.lock();
+
+    if (queueTail) queueTail->next = transaction;
+    else queueHead = transaction;
+    queueTail = transaction;
+
+    queueLock.unlock();
+
+    notify();
+
+    return 0;
+}
+
 err_t I2C::unregisterDevice(DeviceHandle device) {
     if (device == nullptr) return EINVAL;
 
+    busLock.lock();
+
     esp_err_t err = i2c_master_bus_rm_device(device->handle);
 
+    if (!err) registeredAddresses[device->address / 32] &= ~(1ul << (device->address % 32));
+
+    busLock.unlock();
+
     if (err) _loge("failed to unregister i2c device 0x%x: %s", device->address, esp_err_to_name(err));
     else delete device;
 
@@ -109,16 +374,17 @@ err_t I2C::write(DeviceHandle device, uint8_t *data, size_t length, uint32_t tim
     if (device == nullptr || data == nullptr) return EINVAL;
     if (length < 1) return 0;
 
-    esp_err_t err;
+    busLock.lock();
 
-    err = i2c_master_transmit(device->handle, data, length, timeoutMs);
+    err_t err = admit(device);
 
-    if (err) _loge("i2c write %u bytes to 0x%x failed: %s", length, device->address, esp_err_to_name(err));
+    if (!err) {
+        int64_t startUs = esp_timer_get_time();
 
-    switch (err) {
-        case ESP_ERR_TIMEOUT:   err = ETIMEDOUT;    break;
-        case ESP_FAIL:          err = EIO;          break;
+        err = complete(device, i2c_master_transmit(device->handle, data, length, timeoutMs), startUs, "write", length);
     }
 
+    busLock.unlock();
+
     return err;
 }
@@ -3,22 +3,45 @@
 // MIT License
 //
 
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <mbedtls/base64.h>
+
 #include "common.h"
 #include "eventReporter.h"
 #include "gravityDisplay.h"
+#include "lzss.h"
 #include "spiffs.h"
+#include "task.h"
 #include "utility.h"
 
 #define DUMPFILE_FORMAT             "dumpfile-%d.txt"
+// each flush is one block: a little endian uint16 of the text's length, one of the bytes
+// stored, then the bytes. Those are LZSS compressed, or the text itself if that's no larger.
+#define LOGFILE_BLOCK_HEADER_SIZE   4
+#define LOGFILE_BLOCK_MAX_SIZE      (LOGFILE_BLOCK_HEADER_SIZE + LOGFILE_BUFFER_SIZE)
+#define LOGFILE_BUFFER_MAGIC        0x4c4f4742      // "LOGB"
+#define LOGFILE_BUFFER_SIZE         1024
+// buffered messages reach spiffs once the buffer fills or the oldest has waited this long
+#define LOGFILE_FLUSH_INTERVAL_MS   5000
 #define LOGFILE_FORMAT              "logfile-%d.txt"
 #define LOGFILE_MAX_SIZE            2048
 // using a bunch of data on the spiffs partition barfs wifi and causes other issues,
 // see https://esp32.com/viewtopic.php?t=12166 so make 64KB (32 * 2048) of stored log
-// files the high water mark.
+// files the high water mark. Stored compressed, that holds several times as much log.
 //
 // 2021.01.31 bd TODO: ideally logging to the spiffs partition should be turned off once I
 // can figure out why the pico device at the barn keeps going offline.
 #define LOGFILES_MAX                32
+// the longest message the log task renders, longer ones are cut short
+#define LOG_MESSAGE_MAX_LENGTH      256
+
+#if ENABLE_LOGGING_TO_SPIFFS
+// with spiffs logging the log task's wait doubles as the flush timer
+#define LOG_WRITER_WAIT_TICKS       pdMS_TO_TICKS(LOGFILE_FLUSH_INTERVAL_MS)
+#else
+#define LOG_WRITER_WAIT_TICKS       TASK_MAX_WAIT_TICKS
+#endif
 
 #define consoleD(format, ...)       logToSystemLog(LOG_BOLD(LOG_COLOR_RED) "! " LOG_COLOR_D format LOG_RESET_COLOR "\n", ##__VA_ARGS__)
 #define consoleE(format, ...)       logToSystemLog(LOG_BOLD(LOG_COLOR_RED) "! " LOG_COLOR_E format LOG_RESET_COLOR "\n", ##__VA_ARGS__)
@@ -26,27 +49,71 @@
 #define consoleV(format, ...)       logToSystemLog(LOG_BOLD(LOG_COLOR_RED) "! " LOG_COLOR_V format LOG_RESET_COLOR "\n", ##__VA_ARGS__)
 #define consoleW(format, ...)       logToSystemLog(LOG_BOLD(LOG_COLOR_RED) "! " LOG_COLOR_W format LOG_RESET_COLOR "\n", ##__VA_ARGS__)
 
-Log::~Log() {
-#if !ELIDE_DESTRUCTORS_FOR_SINGLETONS
-    _free(topic);
+#if ENABLE_LOGGING_TO_SPIFFS
+// Messages wait here for flushLogFile(). RTC memory isn't cleared by a panic or watchdog
+// reset, so whatever was buffered when the device went down is written out by the next
+// boot's init(). The magic and checksum tell a real buffer from power-on garbage.
+static RTC_NOINIT_ATTR struct {
+    uint32_t                    checksum;               // the sum of data's bytes
+    uint32_t                    length;
+    uint32_t                    magic;
+    char                        data[LOGFILE_BUFFER_SIZE];
+} pendingLog;
+
+// flushLogFile() builds the block here, it's only touched with Log::lock held
+static uint8_t logFileBlock[LOGFILE_BLOCK_MAX_SIZE];
 #endif
-}
 
-cJSON *Log::createJSON(Level level, const char *tag, const char *format, ...) {
+// --- Log::Writer ---
+
+// Writer is the log task. It drains the ring a batch at a time, yielding in between so a
+// burst of logging can't starve tasks of equal priority.
+struct Log::Writer : public Task {
+    using Task::notify;
+
+    void run() override {
+        Log &log = Log::shared();
+
+        if (wait(waitTicks)) {
+            log.drainLock.lock();
+            log.drain();
+            log.drainLock.unlock();
+        }
+
+#if ENABLE_LOGGING_TO_SPIFFS
+        log.flushStaleLogFile();
+#endif
+
+        // while a call site is suppressing, look again once it's due another message
+        waitTicks = LogLimiter::reportSuppressed() ? min(LOG_WRITER_WAIT_TICKS, pdMS_TO_TICKS(LOG_RATE_LIMIT_INTERVAL_MS)) : LOG_WRITER_WAIT_TICKS;
+    }
+
+    TickType_t                  waitTicks = LOG_WRITER_WAIT_TICKS;
+};
+
+// --- Log ---
+
+// vprint() takes a va_list, this gives it one for a preformatted message
+static void displayPrint(Color color, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void displayPrint(Color color, const char *format, ...) {
     va_list args;
     va_start(args, format);
 
-    cJSON *root = createJSON(level, tag, format, args);
+    GravityDisplay::shared().vprint(color, format, args);
 
     va_end(args);
+}
 
-    return root;
+Log::~Log() {
+#if !ELIDE_DESTRUCTORS_FOR_SINGLETONS
+    _free(topic);
+#endif
 }
 
-cJSON *Log::createJSON(Level level, const char *tag, const char *format, va_list args) {
+cJSON *Log::createJSON(Level level, const char *tag, double when, const char *message, const cJSON *data) {
     err_t err = 0;
     cJSON *log = nullptr, *root;
-    char *message = nullptr;
 
     if ((root = cJSON_CreateObject()) == nullptr) err = ENOMEM;
     if (!err && (log = cJSON_CreateObject()) == nullptr) err = ENOMEM;
@@ -64,13 +131,11 @@ cJSON *Log::createJSON(Level level, const char *tag, const char *format, va_list
 
         if (cJSON_AddStringToObject(log, "level", levelString) == nullptr) err = ENOMEM;
     }
-    if (!err && vasprintf(&message, format, args) < 0) err = ENOMEM;
-    if (!err && cJSON_AddStringToObject(log, "message", message) == nullptr) err = ENOMEM;
-
-    _free(message);
-
+    if (!err && message != nullptr && cJSON_AddStringToObject(log, "message", message) == nullptr) err = ENOMEM;
+    // a reference, so deleting the log leaves data to its owner
+    if (!err && data != nullptr && !cJSON_AddItemReferenceToObject(log, "data", (cJSON *) data)) err = ENOMEM;
     if (!err && tag != nullptr && cJSON_AddStringToObject(log, "tag", tag) == nullptr) err = ENOMEM;
-    if (!err && cJSON_AddNumberToObject(log, "timestamp", getCurrentTime()) == nullptr) err = ENOMEM;
+    if (!err && cJSON_AddNumberToObject(log, "timestamp", when) == nullptr) err = ENOMEM;
     if (!err) {
         cJSON_AddItemToObjectCS(root, "log", log);
         log = nullptr;
@@ -81,19 +146,58 @@ cJSON *Log::createJSON(Level level, const char *tag, const char *format, va_list
     if (err) {
         cJSON_Delete(root);
         root = nullptr;
-        _loge("error creating json for log message '%s'", message ? message : "");
+        _loge("error creating json for log message '%s'", message ? message : "(data)");
     }
 
     return root;
 }
 
+void Log::drain() {
+    char message[LOG_MESSAGE_MAX_LENGTH];
+    LogRing::Record *record;
+    size_t count = 0;
+
+    ring.takeWake();
+
+    // before init() the caller drains, and keeps at it until the ring is empty
+    while ((count < batchSize || writer == nullptr) && (record = ring.front()) != nullptr) {
+        // the record carries the esp_timer time it was logged at, backdate the wall clock to it
+        double when = getCurrentTime() - double(esp_timer_get_time() - record->timestamp) / 1000000.0;
+        Level level = Level(record->level);
+        const char *tag = record->tag;
+
+        record->render(message, sizeof(message));
+
+        // the slot is free for reuse once rendered
+        ring.pop();
+
+        publish(level, tag, when, message);
+
+        ++count;
+    }
+
+    uint32_t dropped = ring.getDropped();
+
+    if (dropped != droppedReported) {
+        snprintf(message, sizeof(message), "%lu log messages dropped, the log ring was full", (unsigned long) (dropped - droppedReported));
+        droppedReported = dropped;
+
+        _logw("%s", message);
+        publish(warning, __FILE_NAME__, getCurrentTime(), message);
+    }
+
+    // more is waiting, come back after yielding
+    if (writer && ring.front()) writer->notify();
+}
+
 err_t Log::dumpLogFiles() {
     err_t err = 0;
 
 #if ENABLE_LOGGING_TO_SPIFFS
     char *buffer = nullptr;
-    off_t bufferSize = 3 * 1024;
-    int count = 0, high = 0, low = 0, totalLogfilesBytesUsed = 0;
+    // a block, then room for its base64 encoding
+    size_t bufferSize = LOGFILE_BLOCK_MAX_SIZE + (LOGFILE_BLOCK_MAX_SIZE + 2) / 3 * 4 + 1;
+    int count = 0, high = 0, low = 0;
     char path[SPIFFS_PATH_BUFFER_SIZE];
 
     if ((buffer = (char *) malloc(bufferSize)) == nullptr) err = ENOMEM;
@@ -101,11 +205,19 @@ err_t Log::dumpLogFiles() {
     lock.lock();
 
     if (!err) {
+        // what's still buffered goes out with the dump
+        flushLogFile();
+
         if (file >= 0) {
             close(file);
             file = -1;
         }
-        err = findLogFiles(count, high, low, totalLogfilesBytesUsed);
+        err = indexLogFiles();
+    }
+    if (!err) {
+        count = logFiles.count;
+        high = logFiles.high;
+        low = logFiles.low;
     }
     for (int i = 0; !err && i < count; ++i) {
         char destination[SPIFFS_PATH_BUFFER_SIZE];
@@ -114,9 +226,17 @@ err_t Log::dumpLogFiles() {
         snprintf(path, sizeof(path), SPIFFS_PATH(LOGFILE_FORMAT), logFileNumber);
         snprintf(destination, sizeof(destination), SPIFFS_PATH(DUMPFILE_FORMAT), logFileNumber);
         
-        if (rename(path, destination) < 0) err = errno;
+        if (rename(path, destination) < 0) {
+            err = errno;
+            // those already renamed are still dumped, the rest stay log files
+            count = i;
+        }
     }
 
+    // the log files are all dump files now, a failed rename leaves the index to be rebuilt
+    logFiles = LogFiles();
+    logFiles.isIndexed = !err;
+
     lock.unlock();
 
     if (!err) {
@@ -124,40 +244,53 @@ err_t Log::dumpLogFiles() {
     }
 
     bool isFirstMessage = true;
+    uint8_t *block = (uint8_t *) buffer;
+    unsigned char *text = (unsigned char *) buffer + LOGFILE_BLOCK_MAX_SIZE;
 
-    for (int i = 0; !err && i < count; ++i) {
+    // one block at a time, as stored: the text goes out compressed, base64 encoded, and
+    // the message references the encoding rather than copying it
+    for (int i = 0; i < count; ++i) {
+        // each file is sent or reported on its own, one bad file doesn't hold back the rest
+        err_t fileErr = 0;
         int fd = -1;
         int logFileNumber = i + low;
         struct stat st;
 
         snprintf(path, sizeof(path), SPIFFS_PATH(DUMPFILE_FORMAT), logFileNumber);
 
-        if ((fd = open(path, O_RDONLY)) < 0) err = errno;
-        if (!err && fstat(fd, &st)) err = errno;
+        if ((fd = open(path, O_RDONLY)) < 0) fileErr = errno;
+        if (!fileErr && fstat(fd, &st)) fileErr = errno;
 
-        while (!err && st.st_size > 0) {
-            int bytesToRead = min(st.st_size, bufferSize - 1);
-            int bytesRead = read(fd, buffer, bytesToRead);
-            cJSON *log = nullptr, *root = nullptr;
+        while (!fileErr && st.st_size > 0) {
+            size_t length = 0, stored = 0, textLength = 0;
+            int bytesRead = read(fd, block, LOGFILE_BLOCK_HEADER_SIZE);
+            cJSON *log = nullptr;
 
-            if (bytesRead < 0) err = errno;
-            else {
-                st.st_size -= bytesRead;
+            if (bytesRead < 0) fileErr = errno;
+            else if (bytesRead != LOGFILE_BLOCK_HEADER_SIZE) fileErr = EBADMSG;
+            if (!fileErr) {
+                length = block[0] | block[1] << 8;
+                stored = block[2] | block[3] << 8;
 
-                buffer[bytesRead] = 0;
+                if (length == 0 || length > LOGFILE_BUFFER_SIZE || stored > length) fileErr = EBADMSG;
+            }
+            if (!fileErr && (bytesRead = read(fd, &block[LOGFILE_BLOCK_HEADER_SIZE], stored)) < 0) fileErr = errno;
+            if (!fileErr && size_t(bytesRead) != stored) fileErr = EBADMSG;
+            if (!fileErr) {
+                st.st_size -= LOGFILE_BLOCK_HEADER_SIZE + stored;
 
-                if ((root = cJSON_CreateObject()) == nullptr) err = ENOMEM;
+                if (mbedtls_base64_encode(text, bufferSize - LOGFILE_BLOCK_MAX_SIZE, &textLength, block, LOGFILE_BLOCK_HEADER_SIZE + stored)) fileErr = ENOSPC;
             }
-            if (!err && (log = cJSON_CreateObject()) == nullptr) err = ENOMEM;
-            if (!err && cJSON_AddStringToObject(log, "level", "info") == nullptr) err = ENOMEM;
-            if (!err) {
+            if (!fileErr && (log = cJSON_CreateObject()) == nullptr) fileErr = ENOMEM;
+            if (!fileErr && cJSON_AddStringToObject(log, "level", "info") == nullptr) fileErr = ENOMEM;
+            if (!fileErr) {
                 char message[32];
                 const char *suffix;
 
                 if (isFirstMessage) {
                     suffix = " start";
                     isFirstMessage = false;
-                } else if (i == count - 1 && st.st_size == 0) {
+                } else if (i == count - 1 && st.st_size <= 0) {
                     suffix = " end";
                 } else {
                     suffix = "";
@@ -165,25 +298,32 @@ err_t Log::dumpLogFiles() {
 
                 snprintf(message, sizeof(message), "log dump%s", suffix);
 
-                if (cJSON_AddStringToObject(log, "message", message) == nullptr) err = ENOMEM;
+                if (cJSON_AddStringToObject(log, "message", message) == nullptr) fileErr = ENOMEM;
             }
-            if (!err && cJSON_AddStringToObject(log, "dump", buffer) == nullptr) err = ENOMEM;
-            if (!err && cJSON_AddNumberToObject(log, "timestamp", getCurrentTime()) == nullptr) err = ENOMEM;
-            if (!err) {
-                cJSON_AddItemToObjectCS(root, "log", log);
-                log = nullptr;
+            if (!fileErr) {
+                cJSON *dump = cJSON_CreateStringReference((const char *) text);
+
+                if (dump == nullptr) fileErr = ENOMEM;
+                else cJSON_AddItemToObjectCS(log, "dump", dump);
             }
+            if (!fileErr && cJSON_AddStringToObject(log, "encoding", "lzss-block+base64") == nullptr) fileErr = ENOMEM;
+            if (!fileErr && cJSON_AddNumberToObject(log, "timestamp", getCurrentTime()) == nullptr) fileErr = ENOMEM;
+            if (!fileErr) EventReporter::shared().sendLog(log);
 
             cJSON_Delete(log);
-            cJSON_Delete(root);
         }
         if (fd >= 0) close(fd);
 
-        if (err) consoleE("error %d dumping %s", err, path);
+        if (fileErr) {
+            consoleE("error %d dumping %s", fileErr, path);
+
+            if (!err) err = fileErr;
+        }
     }
 
     _free(buffer);
 
+    // every dump file has been tried, one that failed couldn't be sent again anyway
     for (int i = 0; i < count; ++i) {
         int logFileNumber = i + low;
 
@@ -235,62 +375,136 @@ err_t Log::findLogFiles(int &count, int &high, int &low, int &totalLogfilesBytes
 }
 #endif
 
-err_t Log::init() {
 #if ENABLE_LOGGING_TO_SPIFFS
-    _logw("logging to spiffs is enabled");
+err_t Log::flushLogFile() {
+    err_t err = 0;
+    int written = 0;
 
-    systemLogHandler = esp_log_set_vprintf(logOverride);
-#endif
+    if (pendingLog.length == 0) return 0;
+
+    uint32_t length = pendingLog.length;
+    // only compressed if it comes out smaller
+    size_t stored = LZSS::compress(pendingLog.data, length, &logFileBlock[LOGFILE_BLOCK_HEADER_SIZE], length - 1);
+
+    if (stored == 0) {
+        memcpy(&logFileBlock[LOGFILE_BLOCK_HEADER_SIZE], pendingLog.data, length);
+        stored = length;
+    }
+
+    logFileBlock[0] = uint8_t(length);
+    logFileBlock[1] = uint8_t(length >> 8);
+    logFileBlock[2] = uint8_t(stored);
+    logFileBlock[3] = uint8_t(stored >> 8);
 
-    return 0;
+    err = openLogFile(false);
+
+    if (!err && (written = write(file, logFileBlock, LOGFILE_BLOCK_HEADER_SIZE + stored)) < 0) err = errno;
+    if (!err && size_t(written) != LOGFILE_BLOCK_HEADER_SIZE + stored) err = ENOSPC;
+    if (written > 0) {
+        logFiles.bytes += written;
+        logFiles.highBytes += written;
+    }
+
+    // a block cut short ends the file, anything appended after it couldn't be read back.
+    // Counting the file as full closes it below and the next flush starts a new one.
+    if (err && file >= 0) logFiles.highBytes = LOGFILE_MAX_SIZE;
+
+    // dropped even on error so a full or failing spiffs can't wedge logging
+    pendingLog.checksum = 0;
+    pendingLog.length = 0;
+
+    if (file >= 0 && logFiles.highBytes >= LOGFILE_MAX_SIZE) {
+        close(file);
+        file = -1;
+    }
+
+    return err;
 }
+#endif
 
-void Log::log(Level level, const char *tag, const char *format, ...) {
-    va_list args;
-    va_start(args, format);
+#if ENABLE_LOGGING_TO_SPIFFS
+void Log::flushStaleLogFile() {
+    lock.lock();
 
-    log(level, tag, format, args);
+    if (pendingLog.length && esp_timer_get_time() - bufferedAt >= LOGFILE_FLUSH_INTERVAL_MS * 1000LL) flushLogFile();
 
-    va_end(args);
+    lock.unlock();
 }
+#endif
+
+#if ENABLE_LOGGING_TO_SPIFFS
+err_t Log::indexLogFiles() {
+    err_t err = 0;
+    LogFiles index;
+    char path[SPIFFS_PATH_BUFFER_SIZE];
+    struct stat st;
 
-void Log::log(Level level, const char *tag, const char *format, va_list args) {
-    if (format == nullptr || level < info) return;
+    if (logFiles.isIndexed) return 0;
 
-    Color color;
+    if (!(err = findLogFiles(index.count, index.high, index.low, index.bytes))) {
+        if (index.count < 1) {
+            index.high = index.low = 0;
+        } else {
+            snprintf(path, sizeof(path), SPIFFS_PATH(LOGFILE_FORMAT), index.high);
 
-    switch (level) {
-        case debug:     color = Color::white;   break;
-        case error:     color = Color::red;     break;
-        case info:      color = Color::green;   break;
-        case verbose:   color = Color::purple;  break;
-        case warning:   color = Color::yellow;  break;
-        default:        color = Color::white;   break;
+            // if its size can't be had, treat it as full so the next file is started
+            index.highBytes = stat(path, &st) ? LOGFILE_MAX_SIZE : st.st_size;
+        }
+
+        index.isIndexed = true;
+        logFiles = index;
     }
 
-    GravityDisplay::shared().vprint(color, format, args);
+    return err;
+}
+#endif
 
+err_t Log::init() {
     err_t err = 0;
-    cJSON *root;
+    Writer *newWriter = nullptr;
+
+    if (writer) return EALREADY;
+
+#if ENABLE_LOGGING_TO_SPIFFS
+    _logw("logging to spiffs is enabled");
+
+    recoverLogFile();
+
+    systemLogHandler = esp_log_set_vprintf(logOverride);
 
-    if ((root = createJSON(level, tag, format, args)) == nullptr) err = ENOMEM;
+    esp_register_shutdown_handler(shutdownHandler);
+#endif
+
+    if ((newWriter = new Writer()) == nullptr) err = ENOMEM;
+    if (!err) err = newWriter->startTask("log");
     if (!err) {
-        cJSON *log = cJSON_GetObjectItem(root, "log");
-        EventReporter::shared().sendLog(log);
+        drainLock.lock();
+        writer = newWriter;
+        newWriter = nullptr;
+        drainLock.unlock();
+
+        // pick up anything logged while the handover was in progress
+        writer->notify();
     }
 
-    cJSON_Delete(root);
+    _delete(newWriter);
+
+    if (err) _loge("error %d starting the log task, logging synchronously", err);
+
+    return err;
 }
 
 void Log::log(const cJSON *root, Level level, const char *tag) {
-    err_t err = 0;
-    char *message;
+    cJSON *json;
 
-    if ((message = cJSON_PrintUnformatted(root)) == nullptr) err = ENOMEM;
+    if (root == nullptr || level < publishedLevel) return;
 
-    if (!err) log(level, tag, message);
+    // too big for a ring record, so sent directly, and never printed
+    if ((json = createJSON(level, tag, getCurrentTime(), nullptr, root)) != nullptr) {
+        EventReporter::shared().sendLog(cJSON_GetObjectItem(json, "log"));
+    }
 
-    _cJSON_free(message);
+    cJSON_Delete(json);
 }
 
 #if ENABLE_LOGGING_TO_SPIFFS
@@ -358,51 +572,46 @@ err_t Log::openLogFile(bool forceNextHighestLogFileNumber) {
         file = -1;
     }
 
-    int count, high, low, totalLogfilesBytesUsed;
-    err_t err = 0;
+    err_t err = indexLogFiles();
     int logfilesMax = LOGFILES_MAX - (forceNextHighestLogFileNumber ? 1 : 0);
     int maxAllowedLogfilesBytesUsed = LOGFILES_MAX * LOGFILE_MAX_SIZE;
     char path[SPIFFS_PATH_BUFFER_SIZE];
-    
-    while (!(err = findLogFiles(count, high, low, totalLogfilesBytesUsed))) {
-        if (count < logfilesMax && totalLogfilesBytesUsed < maxAllowedLogfilesBytesUsed) break;
 
-        snprintf(path, sizeof(path), SPIFFS_PATH(LOGFILE_FORMAT), low);
-        unlink(path);
+    while (!err && logFiles.count > 0) {
+        if (logFiles.count < logfilesMax && logFiles.bytes < maxAllowedLogfilesBytesUsed) break;
+
+        unlinkOldestLogFile();
     }
 
     if (!err) {
         int logNumber = 0;
 
-        if (count < 1) {
+        if (logFiles.count < 1) {
             logNumber = 0;
         } else if (forceNextHighestLogFileNumber) {
-            logNumber = high + 1;
+            logNumber = logFiles.high + 1;
         } else {
-            off_t size = INT_MAX;
-            struct stat st;
-
-            snprintf(path, sizeof(path), SPIFFS_PATH(LOGFILE_FORMAT), high);
-            
-            if (!stat(path, &st)) size = st.st_size;
-
-            logNumber = size < LOGFILE_MAX_SIZE ? high : high + 1;
+            logNumber = logFiles.highBytes < LOGFILE_MAX_SIZE ? logFiles.high : logFiles.high + 1;
         }
 
         for (;;) {
             snprintf(path, sizeof(path), SPIFFS_PATH(LOGFILE_FORMAT), logNumber);
 
             if ((file = open(path, O_APPEND | O_CREAT | O_WRONLY)) < 0) err = errno;
-            if (!err || count < 1) break;
+            if (!err || logFiles.count < 1) break;
 
-            snprintf(path, sizeof(path), SPIFFS_PATH(LOGFILE_FORMAT), low);
-            unlink(path);
-
-            --count;
-            ++low;
+            unlinkOldestLogFile();
 
             err = 0;
         }
+
+        if (!err && (logFiles.count < 1 || logNumber > logFiles.high)) {
+            if (logFiles.count < 1) logFiles.low = logNumber;
+
+            ++logFiles.count;
+            logFiles.high = logNumber;
+            logFiles.highBytes = 0;
+        }
     }
     if (!err) {
         isBootupLogFile = false;
@@ -416,29 +625,203 @@ err_t Log::openLogFile(bool forceNextHighestLogFileNumber) {
 }
 #endif
 
+void Log::publish(Level level, const char *tag, double when, const char *message) {
+    Color color;
+
+    switch (level) {
+        case debug:     color = Color::white;   break;
+        case error:     color = Color::red;     break;
+        case info:      color = Color::green;   break;
+        case verbose:   color = Color::purple;  break;
+        case warning:   color = Color::yellow;  break;
+        default:        color = Color::white;   break;
+    }
+
+    displayPrint(color, "%s", message);
+
+    err_t err = 0;
+    cJSON *root;
+
+    if ((root = createJSON(level, tag, when, message)) == nullptr) err = ENOMEM;
+    if (!err) {
+        cJSON *log = cJSON_GetObjectItem(root, "log");
+        EventReporter::shared().sendLog(log);
+    }
+
+    cJSON_Delete(root);
+}
+
+#if ENABLE_LOGGING_TO_SPIFFS
+void Log::recoverLogFile() {
+    uint32_t checksum = 0;
+    bool isValid = pendingLog.magic == LOGFILE_BUFFER_MAGIC && pendingLog.length <= LOGFILE_BUFFER_SIZE;
+
+    for (uint32_t i = 0; isValid && i < pendingLog.length; ++i) checksum += uint8_t(pendingLog.data[i]);
+
+    lock.lock();
+
+    if (isValid && pendingLog.length > 0 && checksum == pendingLog.checksum) {
+        _logw("recovering %lu bytes of log output buffered before the last reset", (unsigned long) pendingLog.length);
+
+        flushLogFile();
+        writeLogFile("! the log output above was recovered after a reset\n");
+    } else {
+        pendingLog.checksum = 0;
+        pendingLog.length = 0;
+    }
+
+    pendingLog.magic = LOGFILE_BUFFER_MAGIC;
+
+    lock.unlock();
+}
+#endif
+
 Log &Log::shared() {
     static Log singleton;
 
     return singleton;
 }
 
+#if ENABLE_LOGGING_TO_SPIFFS
+// a clean restart flushes, a panic leaves the buffer to recoverLogFile()
+void Log::shutdownHandler() {
+    Log &log = shared();
+
+    log.lock.lock();
+    log.flushLogFile();
+    log.lock.unlock();
+}
+#endif
+
+#if ENABLE_LOGGING_TO_SPIFFS
+void Log::unlinkOldestLogFile() {
+    char path[SPIFFS_PATH_BUFFER_SIZE];
+    struct stat st;
+
+    snprintf(path, sizeof(path), SPIFFS_PATH(LOGFILE_FORMAT), logFiles.low);
+
+    if (!stat(path, &st)) logFiles.bytes -= st.st_size;
+
+    unlink(path);
+
+    if (--logFiles.count < 1) {
+        logFiles = LogFiles();
+        logFiles.isIndexed = true;
+    } else {
+        ++logFiles.low;
+    }
+}
+#endif
+
 #if ENABLE_LOGGING_TO_SPIFFS
 err_t Log::writeLogFile(const char *message) {
+    err_t err = 0;
+
     if (message == nullptr) return 0;
 
-    int length = strlen(message);
+    size_t length = strlen(message);
 
-    if (length < 1) return 0;
+    lock.lock();
 
-    err_t err = openLogFile(false);
-    struct stat st;
+    while (!err && length > 0) {
+        if (pendingLog.length == LOGFILE_BUFFER_SIZE) err = flushLogFile();
+        if (!err) {
+            size_t n = min(length, size_t(LOGFILE_BUFFER_SIZE - pendingLog.length));
 
-    if (!err && write(file, message, length) < 0) err = errno;
-    if (file >= 0 && !fstat(file, &st) && st.st_size >= LOGFILE_MAX_SIZE) {
-        close(file);
-        file = -1;
+            if (pendingLog.length == 0) bufferedAt = esp_timer_get_time();
+
+            memcpy(&pendingLog.data[pendingLog.length], message, n);
+
+            for (size_t i = 0; i < n; ++i) pendingLog.checksum += uint8_t(message[i]);
+
+            pendingLog.length += n;
+            message += n;
+            length -= n;
+        }
     }
 
+    lock.unlock();
+
     return err;
 }
 #endif
+
+void Log::wake() {
+    if (writer) {
+        writer->notify();
+        return;
+    }
+
+    // Before init() the caller publishes. A log from within publish() is left in the ring,
+    // the drain already under way on this task picks it up.
+    if (drainLock.isLockHeldByCurrentTask()) return;
+
+    drainLock.lock();
+    drain();
+    drainLock.unlock();
+}
+
+// --- LogLimiter ---
+
+Atomic<LogLimiter *> LogLimiter::suppressing;
+
+void LogLimiter::report(uint32_t count) {
+    esp_log_level_t espLevel;
+
+    switch (level) {
+        case Log::debug:    espLevel = ESP_LOG_DEBUG;   break;
+        case Log::error:    espLevel = ESP_LOG_ERROR;   break;
+        case Log::info:     espLevel = ESP_LOG_INFO;    break;
+        case Log::verbose:  espLevel = ESP_LOG_VERBOSE; break;
+        case Log::warning:  espLevel = ESP_LOG_WARN;    break;
+        default:            espLevel = ESP_LOG_INFO;    break;
+    }
+
+    const char *repeated = format.load(MemoryOrder::relaxed);
+
+    if (repeated) {
+        ESP_LOG_LEVEL(espLevel, tag, "last message repeated %lu times: \"%s\"", (unsigned long) count, repeated);
+        Log::shared().log(level, tag, "last message repeated %lu times: \"%s\"", (unsigned long) count, repeated);
+    } else {
+        ESP_LOG_LEVEL(espLevel, tag, "last message repeated %lu times", (unsigned long) count);
+        Log::shared().log(level, tag, "last message repeated %lu times", (unsigned long) count);
+    }
+}
+
+bool LogLimiter::reportSuppressed() {
+    bool isSuppressing = false;
+    uint32_t time = now();
+
+    for (LogLimiter *limiter = suppressing.load(MemoryOrder::acquire); limiter; limiter = limiter->next) {
+        if (limiter->suppressed.load(MemoryOrder::relaxed) == 0) continue;
+
+        // still over its rate, the site itself reports when it's next let through
+        if (!isAllowed(limiter->dueAt.load(MemoryOrder::relaxed), time)) {
+            isSuppressing = true;
+            continue;
+        }
+
+        // the site went quiet, whichever of us takes the count reports it
+        uint32_t count = limiter->suppressed.exchange(0, MemoryOrder::relaxed);
+
+        if (count) limiter->report(count);
+    }
+
+    return isSuppressing;
+}
+
+// startSuppressing() is called as a site's count goes from 0 to 1
+void LogLimiter::startSuppressing(const char *format) {
+    this->format.store(format, MemoryOrder::relaxed);
+
+    if (!isListed.exchange(true, MemoryOrder::relaxed)) {
+        LogLimiter *head = suppressing.load(MemoryOrder::relaxed);
+
+        do {
+            next = head;
+        } while (!suppressing.compareExchangeWeak(head, this, MemoryOrder::release));
+    }
+
+    // the log task may be in a long wait, have it start checking on this site
+    Log::shared().wake();
+}
@@ -0,0 +1,202 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include "logRing.h"
+
+// --- LogRing::Record ---
+
+void LogRing::Record::putBytes(Type type, const void *bytes, size_t size) {
+    // once an argument is dropped the rest go too, so arguments stay aligned with the format
+    if (isTruncated || length + 1 + size > dataSize) {
+        isTruncated = true;
+        return;
+    }
+
+    data[length++] = uint8_t(type);
+    memcpy(&data[length], bytes, size);
+    length += uint8_t(size);
+}
+
+void LogRing::Record::putString(const char *string) {
+    if (string == nullptr) string = "(null)";
+
+    size_t size = strlen(string);
+
+    // a string is cut short to fit rather than dropped, keeping at least its first bytes
+    if (isTruncated || size_t(length) + 3 > dataSize) {
+        isTruncated = true;
+        return;
+    }
+
+    if (size > dataSize - length - 2) size = dataSize - length - 2;
+    if (size > UINT8_MAX) size = UINT8_MAX;
+
+    data[length++] = uint8_t(Type::string);
+    data[length++] = uint8_t(size);
+    memcpy(&data[length], string, size);
+    length += uint8_t(size);
+}
+
+size_t LogRing::Record::render(char *buffer, size_t size) const {
+    const char *p = format;
+    size_t n = 0, offset = 0;
+
+    if (size == 0) return 0;
+
+    buffer[0] = 0;
+
+    if (p == nullptr) return 0;
+
+    // appends printf style output, clamping n to what fits in buffer
+    auto append = [&](int written) {
+        if (written > 0) n = n + size_t(written) < size - 1 ? n + size_t(written) : size - 1;
+    };
+
+    while (*p && n < size - 1) {
+        if (*p != '%') {
+            buffer[n++] = *p++;
+            continue;
+        }
+
+        if (p[1] == '%') {
+            buffer[n++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // rebuild the conversion with our own length modifier and a conversion that
+        // matches the type actually recorded, so a mismatched format can't misread data
+        char spec[24];
+        size_t s = 0;
+
+        spec[s++] = *p++;
+
+        while (*p && strchr("-+ #0", *p) && s < sizeof(spec) - 8) spec[s++] = *p++;
+        while (*p && (isdigit((unsigned char) *p) || *p == '.' || *p == '*') && s < sizeof(spec) - 8) {
+            if (*p == '*') {
+                // a * width or precision was recorded as an int argument ahead of the value
+                int32_t value = 0;
+
+                if (offset < length && data[offset] == uint8_t(Type::int32)) {
+                    memcpy(&value, &data[offset + 1], sizeof(value));
+                    offset += 1 + sizeof(value);
+                }
+
+                size_t available = sizeof(spec) - s - 8;
+                int written = snprintf(&spec[s], available, "%ld", (long) value);
+
+                // snprintf returns the length it wanted, count only what it wrote
+                if (written > 0) s += size_t(written) < available ? size_t(written) : available - 1;
+                ++p;
+            } else {
+                spec[s++] = *p++;
+            }
+        }
+        while (*p && strchr("hljztLq", *p)) ++p;
+
+        char conversion = *p ? *p++ : 's';
+
+        if (offset >= length) {
+            append(snprintf(&buffer[n], size - n, "?"));
+            continue;
+        }
+
+        Type type = Type(data[offset++]);
+        const uint8_t *value = &data[offset];
+
+        switch (type) {
+            case Type::int32: {
+                int32_t word;
+
+                memcpy(&word, value, sizeof(word));
+                offset += sizeof(word);
+
+                if (!strchr("diouxXc", conversion)) conversion = 'd';
+
+                if (conversion != 'c') spec[s++] = 'l';
+                spec[s++] = conversion;
+                spec[s] = 0;
+
+                if (conversion == 'c') append(snprintf(&buffer[n], size - n, spec, int(word)));
+                else if (conversion == 'd' || conversion == 'i') append(snprintf(&buffer[n], size - n, spec, (long) word));
+                else append(snprintf(&buffer[n], size - n, spec, (unsigned long) uint32_t(word)));
+            } break;
+
+            case Type::int64: {
+                int64_t word;
+
+                memcpy(&word, value, sizeof(word));
+                offset += sizeof(word);
+
+                if (!strchr("diouxX", conversion)) conversion = 'd';
+
+                spec[s++] = 'l';
+                spec[s++] = 'l';
+                spec[s++] = conversion;
+                spec[s] = 0;
+
+                if (conversion == 'd' || conversion == 'i') append(snprintf(&buffer[n], size - n, spec, (long long) word));
+                else append(snprintf(&buffer[n], size - n, spec, (unsigned long long) word));
+            } break;
+
+            case Type::pointer: {
+                const void *pointer;
+
+                memcpy(&pointer, value, sizeof(pointer));
+                offset += sizeof(pointer);
+
+                if (conversion == 'p') {
+                    spec[s++] = 'p';
+                    spec[s] = 0;
+                    append(snprintf(&buffer[n], size - n, spec, pointer));
+                } else {
+                    spec[s++] = 'l';
+                    spec[s++] = strchr("ouxX", conversion) ? conversion : 'u';
+                    spec[s] = 0;
+                    append(snprintf(&buffer[n], size - n, spec, (unsigned long) (uintptr_t) pointer));
+                }
+            } break;
+
+            case Type::real: {
+                double real;
+
+                memcpy(&real, value, sizeof(real));
+                offset += sizeof(real);
+
+                spec[s++] = strchr("aAeEfFgG", conversion) ? conversion : 'g';
+                spec[s] = 0;
+
+                append(snprintf(&buffer[n], size - n, spec, real));
+            } break;
+
+            case Type::string: {
+                char string[UINT8_MAX + 1];
+                size_t stringLength = *value;
+
+                memcpy(string, value + 1, stringLength);
+                string[stringLength] = 0;
+                offset += 1 + stringLength;
+
+                spec[s++] = 's';
+                spec[s] = 0;
+
+                append(snprintf(&buffer[n], size - n, spec, string));
+            } break;
+
+            default:
+                // not something put() writes, nothing after it can be trusted
+                offset = length;
+                append(snprintf(&buffer[n], size - n, "?"));
+                break;
+        }
+    }
+
+    buffer[n] = 0;
+
+    return n;
+}
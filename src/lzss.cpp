@@ -0,0 +1,108 @@
+//
+// Copyright © 2025 Brian Doyle. All rights reserved.
+// MIT License
+//
+
+#include <errno.h>
+
+#include "lzss.h"
+
+// --- LZSS ---
+
+size_t LZSS::compress(const void *source, size_t size, void *destination, size_t capacity) {
+    const uint8_t *in = (const uint8_t *) source;
+    uint8_t *out = (uint8_t *) destination;
+    size_t flagsAt = 0, i = 0, n = 0;
+    unsigned item = 0;
+
+    while (i < size) {
+        if (item == 0) {
+            if (n >= capacity) return 0;
+
+            flagsAt = n;
+            out[n++] = 0;
+        }
+
+        size_t bestLength = 0, bestDistance = 0;
+        size_t limit = size - i < maxMatch ? size - i : maxMatch;
+
+        if (limit >= minMatch) {
+            size_t start = i > windowSize ? i - windowSize : 0;
+
+            // nearest first, so of equally long matches the closest wins
+            for (size_t candidate = i; candidate-- > start; ) {
+                // checking the byte that would make a longer match first rejects most candidates cheaply
+                if (in[candidate + bestLength] != in[i + bestLength] || in[candidate] != in[i]) continue;
+
+                size_t length = 0;
+
+                while (length < limit && in[candidate + length] == in[i + length]) ++length;
+
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = i - candidate;
+
+                    if (length == limit) break;
+                }
+            }
+        }
+
+        if (bestLength >= minMatch) {
+            uint16_t token = uint16_t((bestDistance - 1) << lengthBits | (bestLength - minMatch));
+
+            if (n + 2 > capacity) return 0;
+
+            out[n++] = uint8_t(token);
+            out[n++] = uint8_t(token >> 8);
+            out[flagsAt] |= uint8_t(1 << item);
+
+            i += bestLength;
+        } else {
+            if (n >= capacity) return 0;
+
+            out[n++] = in[i++];
+        }
+
+        item = (item + 1) & 7;
+    }
+
+    return n;
+}
+
+err_t LZSS::decompress(const void *source, size_t size, void *destination, size_t capacity, size_t &length) {
+    const uint8_t *in = (const uint8_t *) source;
+    uint8_t *out = (uint8_t *) destination;
+    size_t i = 0, n = 0;
+
+    length = 0;
+
+    while (i < size) {
+        uint8_t flags = in[i++];
+
+        for (unsigned item = 0; item < 8 && i < size; ++item) {
+            if (flags & (1 << item)) {
+                if (i + 2 > size) return EBADMSG;
+
+                uint16_t token = uint16_t(in[i] | in[i + 1] << 8);
+                size_t distance = (token >> lengthBits) + 1;
+                size_t count = (token & ((1 << lengthBits) - 1)) + minMatch;
+
+                i += 2;
+
+                if (distance > n) return EBADMSG;
+                if (n + count > capacity) return ENOSPC;
+
+                // byte by byte, the match may overlap what it writes
+                for (size_t j = 0; j < count; ++j, ++n) out[n] = out[n - distance];
+            } else {
+                if (n >= capacity) return ENOSPC;
+
+                out[n++] = in[i++];
+            }
+        }
+    }
+
+    length = n;
+
+    return 0;
+}
@@ -3,72 +3,328 @@
 // MIT License
 //
 
+#include <esp_timer.h>
+
 #include "observed.h"
 
+// --- Observed::Message ---
+
 Observed::Message::Message(uint32_t tag, UnixTime when) :
     tag(tag), when(when)
 { }
 
-Observed::~Observed() {
-    lock.lock();
+// --- Observed::Observer ---
+
+Observed::Observer::~Observer() {
+    // messages still queued when the last reference goes are never delivered
+    for (uint8_t i = 0; i < queueCount; ++i) {
+        Message *message = queue[(queueHead + i) % delivery.queueDepth];
+
+        if (message) message->release();
+    }
+
+    _free(queue);
+
+    releaseContext(context);
+}
 
-    size_t i;
+// --- Observed::Snapshot ---
 
-    for (i = 0; i < observersCount; ++i) {
-        observers[i].release(observers[i].context);
-    }   
+Observed::Snapshot::~Snapshot() {
+    for (size_t i = 0; i < count; ++i) observers[i]->release();
 
     _free(observers);
+}
 
-    lock.unlock();
+// --- Observed ---
+
+Observed::~Observed() {
+    _release(snapshot);
 }
 
-void Observed::notifyObservers(Message *message) {
-    lock.lock();
+void Observed::drain(Observer *observer) {
+    for (;;) {
+        Ref<Message> message;
 
-    size_t i, n = observersCount;
+        portENTER_CRITICAL(&observer->stateLock);
 
-    if (n == 0) {
-        lock.unlock();
-        if (message) message->release();
-        return;
+        if (observer->queueCount == 0) {
+            observer->isScheduled = false;
+            portEXIT_CRITICAL(&observer->stateLock);
+            break;
+        }
+
+        message = Ref<Message>::adopt(observer->queue[observer->queueHead]);
+        observer->queueHead = (observer->queueHead + 1) % observer->delivery.queueDepth;
+        --observer->queueCount;
+
+        if (!observer->isRemoved) ++observer->statistics.delivered;
+
+        portEXIT_CRITICAL(&observer->stateLock);
+
+        if (!observer->isRemoved) observer->callback(this, observer->context, message.get());
+    }
+}
+
+void Observed::enqueue(Observer *observer, const Ref<Message> &message) {
+    const uint8_t depth = observer->delivery.queueDepth;
+    // the queue's reference, retained before the lock is taken
+    Message *queued = Ref<Message>(message).detach();
+    Message *discarded = nullptr;
+    bool shouldSchedule = false;
+
+    portENTER_CRITICAL(&observer->stateLock);
+
+    Message **queue = observer->queue;
+    uint8_t head = observer->queueHead;
+    bool isQueued = false;
+
+    if (observer->delivery.backpressure == Backpressure::latestValueWins && queued) {
+        for (uint8_t i = 0; i < observer->queueCount; ++i) {
+            Message *&slot = queue[(head + i) % depth];
+
+            if (slot && slot->tag == queued->tag) {
+                discarded = slot;
+                slot = queued;
+                isQueued = true;
+                ++observer->statistics.coalesced;
+                break;
+            }
+        }
+    }
+
+    if (!isQueued) {
+        if (observer->queueCount == depth) {
+            ++observer->statistics.dropped;
+
+            if (observer->delivery.backpressure == Backpressure::dropNewest) {
+                discarded = queued;
+            } else {
+                discarded = queue[head];
+                queue[head] = queued;
+                observer->queueHead = (head + 1) % depth;
+            }
+        } else {
+            queue[(head + observer->queueCount++) % depth] = queued;
+        }
+    }
+
+    if (!observer->isScheduled) shouldSchedule = observer->isScheduled = true;
+
+    portEXIT_CRITICAL(&observer->stateLock);
+
+    if (discarded) discarded->release();
+
+    if (shouldSchedule) {
+        // the drain holds both so neither goes away with messages still in flight, the
+        // references go with the callable whether it runs or async() fails
+        err_t err = observer->delivery.task->async([self = Ref<Observed>(this), observer = Ref<Observer>(observer)]() {
+            self->drain(observer.get());
+        });
+
+        if (err) {
+            // left queued, the next message tries again
+            portENTER_CRITICAL(&observer->stateLock);
+            observer->isScheduled = false;
+            portEXIT_CRITICAL(&observer->stateLock);
+        }
+    }
+}
+
+err_t Observed::getDeliveryStatisticsFor(void *context, DeliveryStatistics &statistics) {
+    err_t err = ENOENT;
+    Ref<Snapshot> current = retainSnapshot();
+
+    for (size_t i = 0; current && i < current->count; ++i) {
+        Observer *observer = current->observers[i];
+
+        if (observer->context != context || observer->isRemoved) continue;
+
+        portENTER_CRITICAL(&observer->stateLock);
+        statistics = observer->statistics;
+        portEXIT_CRITICAL(&observer->stateLock);
+
+        err = 0;
+        break;
+    }
+
+    return err;
+}
+
+err_t Observed::insert(Ref<Observer> observer, const Filter &filter, const Delivery &delivery) {
+    err_t err = 0;
+    Ref<Snapshot> newSnapshot;
+
+    if (filter.deadband < 0) return EINVAL;
+    if (delivery.task) {
+        if (delivery.queueDepth == 0) return EINVAL;
+        if ((observer->queue = (Message **) calloc(delivery.queueDepth, sizeof(Message *))) == nullptr) return ENOMEM;
     }
 
-    Observer cache[n];
+    observer->delivery = delivery;
+    observer->filter = filter;
+    observer->isFiltered = filter.deadband > 0 || filter.hasTag || filter.minimumIntervalMs;
 
-    if (n > 0) {
-        memcpy(cache, observers, sizeof(Observer) * n);
+    lock.lock();
+
+    size_t i, n = snapshot ? snapshot->count : 0;
 
+    for (i = 0; i < n; ++i) {
+        if (snapshot->observers[i]->context == observer->context && !snapshot->observers[i]->isRemoved) {
+            setErr(EALREADY);
+            break;
+        }
+    }
+
+    if (!err && !(newSnapshot = makeRef<Snapshot>())) setErr(ENOMEM);
+    if (!err && (newSnapshot->observers = (Observer **) malloc(sizeof(Observer *) * (n + 1))) == nullptr) setErr(ENOMEM);
+    if (!err) {
+        // observers whose removal couldn't build a snapshot of its own are dropped here
         for (i = 0; i < n; ++i) {
-            cache[i].retain(cache[i].context);
+            if (snapshot->observers[i]->isRemoved) continue;
+
+            newSnapshot->observers[newSnapshot->count] = snapshot->observers[i];
+            newSnapshot->observers[newSnapshot->count++]->retain();
         }
+
+        // the snapshot takes over the caller's reference
+        newSnapshot->observers[newSnapshot->count++] = observer.detach();
+
+        swapSnapshot(std::move(newSnapshot));
     }
 
     lock.unlock();
 
-    // call the retained, cached versions' callbacks.
-    // this allows the observer to remove and/or release
-    // itself from the observers list during the callback.
-    for (i = 0; i < n; ++i) {
-        // Re-check membership under lock to avoid calling callbacks
-        // for observers that were removed after we built the cache.
-        bool stillPresent = false;
-
-        lock.lock();
-        for (size_t j = 0, m = observersCount; j < m; ++j) {
-            if (observers[j].context == cache[i].context && observers[j].callback == cache[i].callback) {
-                stillPresent = true;
-                break;
+    return err;
+}
+
+void Observed::notifyObservers(Ref<Message> message) {
+    Ref<Snapshot> current = retainSnapshot();
+
+    // the snapshot keeps every observer and its context alive for the pass, so an
+    // observer can remove and/or release itself from within its callback
+    if (current) {
+        for (size_t i = 0; i < current->count; ++i) {
+            Observer *observer = current->observers[i];
+
+            if (observer->isRemoved) continue;
+            if (observer->isFiltered && !passes(observer, message.get())) continue;
+
+            if (observer->delivery.task) {
+                enqueue(observer, message);
+            } else {
+                portENTER_CRITICAL(&observer->stateLock);
+                ++observer->statistics.delivered;
+                portEXIT_CRITICAL(&observer->stateLock);
+
+                observer->callback(this, observer->context, message.get());
             }
         }
-        lock.unlock();
+    }
+}
+
+bool Observed::passes(Observer *observer, const Message *message) {
+    const Filter &filter = observer->filter;
+    int64_t now = esp_timer_get_time();
+    double value;
+    bool hasValue = message && message->getValue(value);
+    bool isPassed = true;
+
+    portENTER_CRITICAL(&observer->stateLock);
+
+    int64_t silenceMs = (now - observer->lastPassedAt) / 1000;
+
+    if (filter.hasTag && (message == nullptr || message->tag != filter.tag)) {
+        isPassed = false;
+    } else if (observer->hasPassed) {
+        bool isHeartbeatDue = filter.maximumSilenceMs && silenceMs >= filter.maximumSilenceMs;
+
+        if (silenceMs < filter.minimumIntervalMs) {
+            isPassed = false;
+        } else if (hasValue && observer->hasPassedValue && !isHeartbeatDue) {
+            double deadband = filter.isDeadbandRelative ? filter.deadband * fabs(observer->lastPassedValue) : filter.deadband;
+
+            if (fabs(value - observer->lastPassedValue) < deadband) isPassed = false;
+        }
+    }
+
+    if (isPassed) {
+        observer->hasPassed = true;
+        observer->lastPassedAt = now;
+
+        if (hasValue) {
+            observer->hasPassedValue = true;
+            observer->lastPassedValue = value;
+        }
+    } else {
+        ++observer->statistics.filtered;
+    }
+
+    portEXIT_CRITICAL(&observer->stateLock);
+
+    return isPassed;
+}
+
+void Observed::remove(void *context) {
+    Observer *removed = nullptr;
+    Ref<Snapshot> newSnapshot;
 
-        if (stillPresent) {
-            cache[i].callback(this, cache[i].context, message);
+    lock.lock();
+
+    size_t i, n = snapshot ? snapshot->count : 0;
+
+    for (i = 0; i < n; ++i) {
+        if (snapshot->observers[i]->context == context && !snapshot->observers[i]->isRemoved) {
+            removed = snapshot->observers[i];
+            break;
         }
+    }
+
+    if (removed) {
+        removed->isRemoved = true;
+
+        if (n > 1) {
+            // if this fails the observer stays in the snapshot but is skipped, and goes with the next insert()
+            if ((newSnapshot = makeRef<Snapshot>()) &&
+                (newSnapshot->observers = (Observer **) malloc(sizeof(Observer *) * (n - 1))) != nullptr)
+            {
+                for (i = 0; i < n; ++i) {
+                    if (snapshot->observers[i]->isRemoved) continue;
 
-        cache[i].release(cache[i].context);
+                    newSnapshot->observers[newSnapshot->count] = snapshot->observers[i];
+                    newSnapshot->observers[newSnapshot->count++]->retain();
+                }
+
+                swapSnapshot(newSnapshot->count ? std::move(newSnapshot) : nullptr);
+            }
+        } else {
+            swapSnapshot(nullptr);
+        }
     }
 
-    if (message) message->release();
+    lock.unlock();
+}
+
+Ref<Observed::Snapshot> Observed::retainSnapshot() {
+    portENTER_CRITICAL(&snapshotLock);
+
+    Ref<Snapshot> current(snapshot);
+
+    portEXIT_CRITICAL(&snapshotLock);
+
+    return current;
+}
+
+void Observed::swapSnapshot(Ref<Snapshot> newSnapshot) {
+    // released on the way out, after the lock. A notify pass still holding the old
+    // snapshot keeps it alive until it finishes.
+    Ref<Snapshot> oldSnapshot;
+
+    portENTER_CRITICAL(&snapshotLock);
+
+    // snapshot stays a raw pointer so isObserved() can read it without the lock
+    oldSnapshot = Ref<Snapshot>::adopt(snapshot);
+    snapshot = newSnapshot.detach();
+
+    portEXIT_CRITICAL(&snapshotLock);
 }